@@ -0,0 +1,72 @@
+/*
+ * microbenchmark of the memory accessors: single entry and bit field
+ * access, the port datain/dataout accessors and the page-chunked array
+ * copies. prints nanoseconds per access.
+ *
+ * make bench_mem && ./bench_mem [iterations]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "llsim.h"
+
+#define BENCH_HEIGHT	(64 * 1024)
+
+static volatile int sink;
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define BENCH(name, n, body)							\
+	do {									\
+		double t = bench_now();						\
+		long i;								\
+		for (i = 0; i < (n); i++) {					\
+			body;							\
+		}								\
+		printf("  %-36s %6.2f ns/op\n", name, (bench_now() - t) / (n));	\
+	} while (0)
+
+static void bench_unit(llsim_unit_t *unit)
+{
+}
+
+int main(int argc, char **argv)
+{
+	long iters = argc > 1 ? atol(argv[1]) : 50000000;
+	long copies = iters / BENCH_HEIGHT + 1;
+	llsim_t *sim = llsim_create();
+	llsim_memory_t *mem;
+	static int buf[BENCH_HEIGHT];
+	int mask = BENCH_HEIGHT - 1, sum = 0;
+
+	mem = llsim_allocate_memory(llsim_register_unit(sim, "bench", bench_unit), "mem", 32, BENCH_HEIGHT, 0);
+	// materialize every page so the loops time accesses, not allocation
+	llsim_mem_inject_array(mem, 0, buf, BENCH_HEIGHT);
+
+	printf("%d entry 32 bit memory, %ld iterations\n", BENCH_HEIGHT, iters);
+	BENCH("llsim_mem_inject 31:0", iters, llsim_mem_inject(mem, i & mask, i, 31, 0));
+	BENCH("llsim_mem_extract 31:0", iters, sum += llsim_mem_extract(mem, i & mask, 31, 0));
+	BENCH("llsim_mem_extract 31:0 scattered", iters, sum += llsim_mem_extract(mem, (i * 40503) & mask, 31, 0));
+	BENCH("llsim_mem_extract varying field", iters, sum += llsim_mem_extract(mem, i & mask, (i & 15) + 15, i & 15));
+	BENCH("llsim_mem_inject varying field", iters, llsim_mem_inject(mem, i & mask, i, (i & 15) + 15, i & 15));
+	BENCH("set_datain + extract_dataout", iters,
+	      llsim_mem_set_datain(mem, i, 31, 0); sum += llsim_mem_extract_dataout(mem, 31, 0));
+	BENCH("llsim_mem_inject_array, per entry", copies * BENCH_HEIGHT,
+	      if ((i & mask) == 0) llsim_mem_inject_array(mem, 0, buf, BENCH_HEIGHT));
+	BENCH("llsim_mem_extract_array, per entry", copies * BENCH_HEIGHT,
+	      if ((i & mask) == 0) llsim_mem_extract_array(mem, 0, buf, BENCH_HEIGHT));
+	BENCH("llsim_mem_inject loop, per entry", copies * BENCH_HEIGHT,
+	      llsim_mem_inject(mem, i & mask, buf[i & mask], 31, 0));
+	BENCH("llsim_mem_extract loop, per entry", copies * BENCH_HEIGHT,
+	      buf[i & mask] = llsim_mem_extract(mem, i & mask, 31, 0));
+	sink = sum + buf[0];
+
+	llsim_destroy(sim);
+	return 0;
+}
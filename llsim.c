@@ -1,365 +1,3478 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/select.h>
 #include "llsim.h"
 
+__thread llsim_t *llsim_current;
+
+static __thread llsim_unit_t *current_unit;
+
 /*
- * chip simulator
+ * arena
  */
-llsim_t *llsim = NULL;
-static int stop_sim = 0;
+static void *llsim_arena_alloc(llsim_arena_t *arena, size_t len)
+{
+	llsim_arena_chunk_t *chunk;
+	size_t size;
+
+	len = (len + 15) & ~(size_t) 15;
+	if (len <= arena->left) {
+		arena->cur += len;
+		arena->left -= len;
+		return arena->cur - len;
+	}
+
+	// big requests get a chunk of their own, the current one stays open
+	size = len > LLSIM_ARENA_CHUNK / 4 ? len : LLSIM_ARENA_CHUNK;
+	chunk = (llsim_arena_chunk_t *) calloc(1, sizeof(llsim_arena_chunk_t) + size);
+	if (chunk == NULL) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->size += size;
+	if (size == len)
+		return chunk + 1;
+	arena->cur = (char *) (chunk + 1) + len;
+	arena->left = size - len;
+	return chunk + 1;
+}
 
-void *llsim_malloc(int len)
+// zeroed memory that lives as long as the simulation
+void *llsim_malloc(llsim_t *sim, int len)
 {
 	void *p;
 
-	p = (void *) malloc(len);
-	llsim_assert(p != NULL, "out of memory");
-	memset(p, 0, len);
+	// units running on the pool may materialize memory pages
+	if (!sim->pool.threads)
+		return llsim_arena_alloc(&sim->arena, len);
+	pthread_mutex_lock(&sim->pool.lock);
+	p = llsim_arena_alloc(&sim->arena, len);
+	pthread_mutex_unlock(&sim->pool.lock);
+	return p;
+}
+
+/*
+ * name hashing
+ */
+static unsigned int llsim_str_hash(char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 16777619u;
+	return h;
+}
+
+static unsigned int llsim_ptr_hash(void *p)
+{
+	unsigned long long v = (unsigned long long) p;
+
+	return (unsigned int) ((v >> 3) * 0x9e3779b97f4a7c15ULL >> 32);
+}
+
+// slot holding key, or the empty slot where it belongs
+static int llsim_hash_slot(llsim_hash_t *h, void *key, unsigned int hv, int by_string)
+{
+	int i;
+
+	i = hv & (h->size - 1);
+	while (h->keys[i]) {
+		if (h->keys[i] == key || (by_string && strcmp(h->keys[i], key) == 0))
+			break;
+		i = (i + 1) & (h->size - 1);
+	}
+	return i;
+}
+
+static void *llsim_hash_get(llsim_hash_t *h, void *key, unsigned int hv, int by_string)
+{
+	if (!h->size || !key)
+		return NULL;
+	return h->vals[llsim_hash_slot(h, key, hv, by_string)];
+}
+
+static void llsim_hash_put(llsim_t *sim, llsim_hash_t *h, void *key, unsigned int hv, int by_string, void *val)
+{
+	llsim_hash_t old;
+	int i;
+
+	if (2 * (h->count + 1) > h->size) {
+		old = *h;
+		h->size = old.size ? 2 * old.size : 16;
+		h->count = 0;
+		h->keys = (void **) llsim_malloc(sim, h->size * sizeof(void *));
+		h->vals = (void **) llsim_malloc(sim, h->size * sizeof(void *));
+		for (i = 0; i < old.size; i++) {
+			if (old.keys[i])
+				llsim_hash_put(sim, h, old.keys[i], by_string ? llsim_str_hash(old.keys[i]) : llsim_ptr_hash(old.keys[i]), by_string, old.vals[i]);
+		}
+		// the old arrays stay in the arena, at most as much again
+	}
+	i = llsim_hash_slot(h, key, hv, by_string);
+	if (!h->keys[i])
+		h->count++;
+	h->keys[i] = key;
+	h->vals[i] = val;
+}
+
+// interned copy of name, NULL if it was never interned
+static char *llsim_intern_find(llsim_t *sim, char *name)
+{
+	return llsim_hash_get(&sim->names, name, llsim_str_hash(name), 1);
+}
+
+char *llsim_intern(llsim_t *sim, char *name)
+{
+	char *p;
+
+	p = llsim_intern_find(sim, name);
+	if (!p) {
+		p = llsim_malloc(sim, strlen(name)+1);
+		strcpy(p, name);
+		llsim_hash_put(sim, &sim->names, p, llsim_str_hash(p), 1, p);
+	}
 	return p;
 }
 
+static void *llsim_table_get(llsim_t *sim, llsim_hash_t *h, char *name)
+{
+	name = llsim_intern_find(sim, name);
+	return llsim_hash_get(h, name, llsim_ptr_hash(name), 0);
+}
+
+static void llsim_table_put(llsim_t *sim, llsim_hash_t *h, char *name, void *val)
+{
+	llsim_hash_put(sim, h, name, llsim_ptr_hash(name), 0, val);
+}
+
 /*
  * unit registration functions
  */
-llsim_unit_t *llsim_register_unit(char *name, void (*run) (struct llsim_unit_s *unit))
+llsim_unit_t *llsim_register_unit(llsim_t *sim, char *name, void (*run) (struct llsim_unit_s *unit))
 {
 	llsim_unit_t *unit;
 
-	unit = (llsim_unit_t *) llsim_malloc(sizeof(llsim_unit_t));
-	unit->name = llsim_malloc(strlen(name)+1);
-	strcpy(unit->name, name);
+	llsim_assert(!sim->finalized, "ERROR: unit %s registered after llsim_finalize", name);
+	llsim_assert(llsim_find_unit(sim, name) == NULL, "ERROR: unit %s registered twice", name);
+	unit = (llsim_unit_t *) llsim_malloc(sim, sizeof(llsim_unit_t));
+	unit->sim = sim;
+	unit->name = llsim_intern(sim, name);
 	unit->run = run;
-	unit->next = llsim->units;
+	unit->next = sim->units;
 	unit->regs = NULL;
-	llsim->units = unit;
+	unit->registers_tail = &unit->registers;
+	unit->outputs_tail = &unit->outputs;
+	unit->inputs_tail = &unit->inputs;
+	unit->wires_tail = &unit->wires;
+	unit->wake_clock = INT_MAX;
+	unit->period = 1;
+	sim->units = unit;
+	sim->nr_units++;
+	llsim_table_put(sim, &sim->unit_table, unit->name, unit);
 	return unit;
 }
 
-llsim_unit_t *llsim_find_unit(char *name)
+llsim_unit_t *llsim_find_unit(llsim_t *sim, char *name)
 {
-	llsim_unit_t *unit;
+	return llsim_table_get(sim, &sim->unit_table, name);
+}
 
-	unit = llsim->units;
-	while (unit) {
-		if (strcmp(name, unit->name) == 0)
-			break;
-		unit = unit->next;
-	}
-	return unit;
+llsim_register_t *llsim_find_register(llsim_unit_t *unit, char *reg_name)
+{
+	return llsim_table_get(unit->sim, &unit->register_table, reg_name);
+}
+
+llsim_output_t *llsim_find_output(llsim_unit_t *unit, char *output_name)
+{
+	return llsim_table_get(unit->sim, &unit->output_table, output_name);
+}
+
+llsim_input_t *llsim_find_input(llsim_unit_t *unit, char *input_name)
+{
+	return llsim_table_get(unit->sim, &unit->input_table, input_name);
+}
+
+llsim_wire_t *llsim_find_wire(llsim_unit_t *unit, char *wire_name)
+{
+	return llsim_table_get(unit->sim, &unit->wire_table, wire_name);
 }
 
 llsim_unit_registers_t *llsim_allocate_registers(llsim_unit_t *unit, char *name, int size)
 {
+	llsim_t *sim = unit->sim;
 	llsim_unit_registers_t *ur;
 
-	ur = (llsim_unit_registers_t *) llsim_malloc(sizeof(llsim_unit_registers_t));
-	ur->name = (char *) llsim_malloc(strlen(name)+1);
-	strcpy(ur->name, name);
+	llsim_assert(!sim->finalized, "ERROR: registers %s allocated after llsim_finalize", name);
+	ur = (llsim_unit_registers_t *) llsim_malloc(sim, sizeof(llsim_unit_registers_t));
+	ur->sim = sim;
+	ur->name = llsim_intern(sim, name);
 	ur->size = size;
-	ur->old = (void *) llsim_malloc(size);
-	ur->new = (void *) llsim_malloc(size);
+	ur->old = (void *) llsim_malloc(sim, size);
+	ur->new = (void *) llsim_malloc(sim, size);
 	ur->next = unit->regs;
 	unit->regs = ur;
+	sim->nr_regs++;
 	return ur;
 }
 
-void llsim_register_register(char *unit_name, char *reg_name, int bits, int reset_value, void *oldp, void *newp)
+void llsim_track_registers(llsim_unit_registers_t *ur)
+{
+	llsim_t *sim = ur->sim;
+
+	ur->dirty_len = ((ur->size + 3) / 4 + 63) / 64;
+	ur->dirty = (unsigned long long *) llsim_malloc(sim, ur->dirty_len * sizeof(unsigned long long));
+	// old and new may differ until the first commit
+	llsim_reg_track_all(ur);
+}
+
+static void llsim_commit_registers(llsim_unit_registers_t *ur)
+{
+	int *old, *new;
+	unsigned long long bits;
+	int i, word, words;
+
+	if (!ur->dirty) {
+		memcpy(ur->old, ur->new, ur->size);
+		return;
+	}
+
+	old = ur->new;
+	new = ur->old;
+	ur->old = old;
+	ur->new = new;
+
+	words = (ur->size + 3) / 4;
+	for (i = 0; i < ur->dirty_len; i++) {
+		bits = ur->dirty[i];
+		ur->dirty[i] = 0;
+		while (bits) {
+			word = i * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			if (word < words)
+				new[word] = old[word];
+		}
+	}
+#ifdef LLSIM_CHECK_TRACKING
+	llsim_assert(memcmp(ur->old, ur->new, ur->size) == 0, "ERROR: untracked write to registers %s\n", ur->name);
+#endif
+}
+
+void llsim_register_register(llsim_t *sim, char *unit_name, char *reg_name, int bits, int reset_value, void *oldp, void *newp, int flags)
 {
 	llsim_unit_t *unit;
-	llsim_register_t *reg, *p;
+	llsim_register_t *reg;
+	llsim_unit_registers_t *ur;
 
-	unit = llsim_find_unit(unit_name);
+	unit = llsim_find_unit(sim, unit_name);
 	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+	llsim_assert(llsim_find_register(unit, reg_name) == NULL, "ERROR: register %s.%s registered twice", unit_name, reg_name);
 
-	reg = (llsim_register_t *) llsim_malloc(sizeof(llsim_register_t));
-	reg->unit_name = (char *) llsim_malloc(strlen(unit_name)+1);
-	strcpy(reg->unit_name, unit_name);
-	reg->reg_name = (char *) llsim_malloc(strlen(reg_name)+1);
-	strcpy(reg->reg_name, reg_name);
+	reg = (llsim_register_t *) llsim_malloc(sim, sizeof(llsim_register_t));
+	reg->unit_name = unit->name;
+	reg->reg_name = llsim_intern(sim, reg_name);
 	reg->bits = bits;
 	reg->reset_value = reset_value;
+	reg->flags = flags;
 	reg->oldp = oldp;
 	reg->newp = newp;
+	reg->oldbase = &reg->oldp;
+	reg->newbase = &reg->newp;
+	reg->offset = 0;
+	for (ur = unit->regs; ur; ur = ur->next) {
+		if ((char *) oldp >= (char *) ur->old && (char *) oldp < (char *) ur->old + ur->size) {
+			llsim_assert((char *) newp - (char *) ur->new == (char *) oldp - (char *) ur->old,
+				     "ERROR: register %s.%s old and new copies at different offsets\n", unit_name, reg_name);
+			reg->oldbase = &ur->old;
+			reg->newbase = &ur->new;
+			reg->offset = (char *) oldp - (char *) ur->old;
+			break;
+		}
+	}
 	reg->next = NULL;
-	if (!unit->registers) {
-		unit->registers = reg;
-	} else {
-		p = unit->registers;
-		while (p->next)
-			p = p->next;
-		p->next = reg;
+	*unit->registers_tail = reg;
+	unit->registers_tail = &reg->next;
+	llsim_table_put(sim, &unit->register_table, reg->reg_name, reg);
+}
+
+/*
+ * one "name value" line per traced register of the unit, in registration
+ * order, with the value in 8 hex digits. lines are formatted by hand into
+ * a buffer written out in large pieces.
+ */
+void llsim_trace_registers(llsim_unit_t *unit, FILE *fp)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[4096], *p = buf, *name;
+	llsim_register_t *reg;
+	unsigned int val;
+	int i;
+
+	for (reg = unit->registers; reg; reg = reg->next) {
+		if (!(reg->flags & LLSIM_REG_TRACE))
+			continue;
+		if (p + strlen(reg->reg_name) + 10 > buf + sizeof(buf)) {
+			fwrite(buf, 1, p - buf, fp);
+			p = buf;
+		}
+		for (name = reg->reg_name; *name; name++)
+			*p++ = *name;
+		*p++ = ' ';
+		val = *(unsigned int *) llsim_reg_old(reg);
+		for (i = 7; i >= 0; i--) {
+			p[i] = hex[val & 0xf];
+			val >>= 4;
+		}
+		p[8] = '\n';
+		p += 9;
 	}
+	fwrite(buf, 1, p - buf, fp);
 }
 
-void llsim_register_wire(char *unit_name, char *wire_name, int bits, void *wirep)
+void llsim_register_wire(llsim_t *sim, char *unit_name, char *wire_name, int bits, void *wirep)
 {
-	// FIXME
+	llsim_unit_t *unit;
+	llsim_wire_t *wire;
+
+	unit = llsim_find_unit(sim, unit_name);
+	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+	llsim_assert(llsim_find_wire(unit, wire_name) == NULL, "ERROR: wire %s.%s registered twice", unit_name, wire_name);
+
+	wire = (llsim_wire_t *) llsim_malloc(sim, sizeof(llsim_wire_t));
+	wire->unit_name = unit->name;
+	wire->wire_name = llsim_intern(sim, wire_name);
+	wire->bits = bits;
+	wire->wirep = wirep;
+	wire->driver = NULL;
+	wire->next = NULL;
+	*unit->wires_tail = wire;
+	unit->wires_tail = &wire->next;
+	llsim_table_put(sim, &unit->wire_table, wire->wire_name, wire);
+}
+
+static llsim_wire_t *llsim_lookup_wire(llsim_t *sim, char *unit_name, char *wire_name)
+{
+	llsim_unit_t *unit;
+	llsim_wire_t *wire;
+
+	unit = llsim_find_unit(sim, unit_name);
+	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+	wire = llsim_find_wire(unit, wire_name);
+	llsim_assert(wire != NULL, "ERROR: couldn't find wire %s.%s", unit_name, wire_name);
+	return wire;
+}
+
+llsim_comb_t *llsim_register_comb(llsim_t *sim, char *unit_name, char *comb_name, void (*eval) (struct llsim_unit_s *unit))
+{
+	llsim_unit_t *unit;
+	llsim_comb_t *comb;
+
+	llsim_assert(!sim->finalized, "ERROR: comb %s registered after llsim_finalize", comb_name);
+	unit = llsim_find_unit(sim, unit_name);
+	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+
+	comb = (llsim_comb_t *) llsim_malloc(sim, sizeof(llsim_comb_t));
+	comb->name = llsim_intern(sim, comb_name);
+	comb->eval = eval;
+	comb->unit = unit;
+	comb->next = unit->combs;
+	unit->combs = comb;
+	sim->nr_combs++;
+	return comb;
+}
+
+void llsim_comb_drives(llsim_comb_t *comb, char *unit_name, char *wire_name)
+{
+	llsim_t *sim = comb->unit->sim;
+	llsim_wire_t *wire;
+
+	wire = llsim_lookup_wire(sim, unit_name, wire_name);
+	llsim_assert(wire->driver == NULL, "ERROR: wire %s.%s driven by both %s.%s and %s.%s",
+		     unit_name, wire_name, wire->driver->unit->name, wire->driver->name, comb->unit->name, comb->name);
+	wire->driver = comb;
+}
+
+void llsim_comb_reads(llsim_comb_t *comb, char *unit_name, char *wire_name)
+{
+	llsim_t *sim = comb->unit->sim;
+	llsim_comb_read_t *read;
+
+	read = (llsim_comb_read_t *) llsim_malloc(sim, sizeof(llsim_comb_read_t));
+	read->wire = llsim_lookup_wire(sim, unit_name, wire_name);
+	read->next = comb->reads;
+	comb->reads = read;
 }
 
-void llsim_register_output(char *unit_name, char *output_name, int bits, void *oldp, void *newp)
+void llsim_register_output(llsim_t *sim, char *unit_name, char *output_name, int bits, void *oldp, void *newp)
 {
 	llsim_unit_t *unit;
-	llsim_output_t *output, *p;
+	llsim_output_t *output;
 
-	unit = llsim_find_unit(unit_name);
+	unit = llsim_find_unit(sim, unit_name);
 	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+	llsim_assert(llsim_find_output(unit, output_name) == NULL, "ERROR: output %s.%s registered twice", unit_name, output_name);
 
-	output = (llsim_output_t *) llsim_malloc(sizeof(llsim_output_t));
-	output->unit_name = (char *) llsim_malloc(strlen(unit_name)+1);
-	strcpy(output->unit_name, unit_name);
-	output->output_name = (char *) llsim_malloc(strlen(output_name)+1);
-	strcpy(output->output_name, output_name);
+	output = (llsim_output_t *) llsim_malloc(sim, sizeof(llsim_output_t));
+	output->unit_name = unit->name;
+	output->output_name = llsim_intern(sim, output_name);
 	output->bits = bits;
 	output->oldp = oldp;
 	output->newp = newp;
 	output->next = NULL;
-	if (!unit->outputs) {
-		unit->outputs = output;
-	} else {
-		p = unit->outputs;
-		while (p->next)
-			p = p->next;
-		p->next = output;
-	}
+	*unit->outputs_tail = output;
+	unit->outputs_tail = &output->next;
+	llsim_table_put(sim, &unit->output_table, output->output_name, output);
 }
 
-void llsim_register_input(char *unit_name, char *input_name, int bits, void *oldp, void *newp)
+void llsim_register_input(llsim_t *sim, char *unit_name, char *input_name, int bits, void *oldp, void *newp)
 {
 	llsim_unit_t *unit;
-	llsim_input_t *input, *p;
+	llsim_input_t *input;
 
-	unit = llsim_find_unit(unit_name);
+	unit = llsim_find_unit(sim, unit_name);
 	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", unit_name);
+	llsim_assert(llsim_find_input(unit, input_name) == NULL, "ERROR: input %s.%s registered twice", unit_name, input_name);
 
-	input = (llsim_input_t *) llsim_malloc(sizeof(llsim_input_t));
-	input->unit_name = (char *) llsim_malloc(strlen(unit_name)+1);
-	strcpy(input->unit_name, unit_name);
-	input->input_name = (char *) llsim_malloc(strlen(input_name)+1);
-	strcpy(input->input_name, input_name);
+	input = (llsim_input_t *) llsim_malloc(sim, sizeof(llsim_input_t));
+	input->unit_name = unit->name;
+	input->input_name = llsim_intern(sim, input_name);
 	input->bits = bits;
 	input->oldp = oldp;
 	input->newp = newp;
+	input->base = &input->oldp;
+	input->offset = 0;
+	input->source = NULL;
 	input->next = NULL;
-	if (!unit->inputs) {
-		unit->inputs = input;
-	} else {
-		p = unit->inputs;
-		while (p->next)
-			p = p->next;
-		p->next = input;
+	*unit->inputs_tail = input;
+	unit->inputs_tail = &input->next;
+	llsim_table_put(sim, &unit->input_table, input->input_name, input);
+}
+
+/*
+ * alias the input to the output's old copy. outputs inside one of the
+ * producer's register blocks are reached through the block, whose old
+ * pointer moves on tracked commits; any other output storage is fixed.
+ */
+void llsim_bind(llsim_t *sim, char *output_unit, char *output_name, char *input_unit, char *input_name)
+{
+	llsim_unit_t *producer, *consumer;
+	llsim_output_t *output;
+	llsim_input_t *input;
+	llsim_unit_registers_t *ur;
+	char *p;
+
+	llsim_assert(!sim->finalized, "ERROR: %s.%s bound after llsim_finalize", input_unit, input_name);
+	producer = llsim_find_unit(sim, output_unit);
+	llsim_assert(producer != NULL, "ERROR: couldn't find unit %s", output_unit);
+	consumer = llsim_find_unit(sim, input_unit);
+	llsim_assert(consumer != NULL, "ERROR: couldn't find unit %s", input_unit);
+	output = llsim_find_output(producer, output_name);
+	llsim_assert(output != NULL, "ERROR: couldn't find output %s.%s", output_unit, output_name);
+	input = llsim_find_input(consumer, input_name);
+	llsim_assert(input != NULL, "ERROR: couldn't find input %s.%s", input_unit, input_name);
+	llsim_assert(input->source == NULL, "ERROR: input %s.%s bound twice", input_unit, input_name);
+	llsim_assert(input->bits == output->bits, "ERROR: binding %d bit output %s.%s to %d bit input %s.%s",
+		     output->bits, output_unit, output_name, input->bits, input_unit, input_name);
+
+	p = (char *) output->oldp;
+	input->base = &output->oldp;
+	input->offset = 0;
+	for (ur = producer->regs; ur; ur = ur->next) {
+		if (p >= (char *) ur->old && p < (char *) ur->old + ur->size) {
+			input->base = &ur->old;
+			input->offset = p - (char *) ur->old;
+			break;
+		}
 	}
+	input->source = output;
 }
 
+/*
+ * fields of up to 32 bits at any bit offset of a byte buffer. only the
+ * (at most 5) bytes holding the field are read or written.
+ */
 int generic_extract_bits(char *p, int msb, int lsb)
 {
-	int byte_pos;
-	i64 *p64, val64;
+	unsigned long long val = 0;
+	int first = lsb / 8, i;
 
-	byte_pos = lsb / 8;
-
-	p64 = (i64 *) (p + byte_pos);
-	val64 = lsbs(*p64, msb - byte_pos * 8, lsb - byte_pos * 8);
-	return (int) val64;
+	for (i = msb / 8; i >= first; i--)
+		val = (val << 8) | (unsigned char) p[i];
+	return (int) lsbs(val, msb - first * 8, lsb - first * 8);
 }
 
 void generic_inject_bits(char *p, int data, int msb, int lsb)
 {
-	int byte_pos;
-	i64 *p64;
+	unsigned long long val = 0;
+	int first = lsb / 8, last = msb / 8, i;
 
-	byte_pos = lsb / 8;
-	p64 = (i64 *) (p + byte_pos);
-	*p64 = lrbs(*p64, data, msb - byte_pos * 8, lsb - byte_pos * 8);
+	for (i = last; i >= first; i--)
+		val = (val << 8) | (unsigned char) p[i];
+	val = lrbs(val, data, msb - first * 8, lsb - first * 8);
+	for (i = first; i <= last; i++, val >>= 8)
+		p[i] = (char) val;
 }
 
 /*
  * memories
  */
+int llsim_zero_page[LLSIM_MEM_PAGE_ENTRIES * LLSIM_MEM_MAX_BITS / 32];
+
+/*
+ * write protected memories, see llsim_snapshot_protect. the fault
+ * handler finds the memory of a faulting address among all simulations
+ * of the process, lists the pages around it as changed and lets the
+ * write go ahead.
+ */
+#define LLSIM_MAX_PROTECTED	256
+
+static llsim_memory_t *llsim_protected[LLSIM_MAX_PROTECTED];
+static struct sigaction llsim_protect_prev;
+static pthread_once_t llsim_protect_once = PTHREAD_ONCE_INIT;
+static size_t llsim_os_page;
+
+// the system pages holding a memory page
+static void llsim_mem_page_range(llsim_memory_t *memory, int page, char **start, size_t *len)
+{
+	size_t page_len = LLSIM_MEM_PAGE_ENTRIES * memory->entry_size * sizeof(int);
+	size_t first = (size_t) page * page_len & ~(llsim_os_page - 1);
+	size_t end = ((size_t) (page + 1) * page_len + llsim_os_page - 1) & ~(llsim_os_page - 1);
+
+	*start = memory->area + first;
+	*len = end - first;
+}
+
+static void llsim_mem_snap_dirty(llsim_memory_t *memory, int page)
+{
+	if (!(memory->page_dirty[page] & LLSIM_PAGE_SNAP)) {
+		memory->page_dirty[page] |= LLSIM_PAGE_SNAP;
+		memory->snap_dirty[memory->nr_snap_dirty++] = page;
+	}
+}
+
+// writes to every memory page sharing a system page with this one stop faulting
+static void llsim_mem_unprotect(llsim_memory_t *memory, int page)
+{
+	size_t page_len = LLSIM_MEM_PAGE_ENTRIES * memory->entry_size * sizeof(int);
+	size_t first, end;
+	char *start;
+	size_t len;
+
+	llsim_mem_page_range(memory, page, &start, &len);
+	mprotect(start, len, PROT_READ | PROT_WRITE);
+	first = (start - memory->area) / page_len;
+	end = (start + len - memory->area + page_len - 1) / page_len;
+	for (; first < end && first < memory->nr_pages; first++)
+		llsim_mem_snap_dirty(memory, first);
+}
+
+static void llsim_mem_page_changed(llsim_memory_t *memory, int page);
+
+static void llsim_protect_fault(int sig, siginfo_t *si, void *ctx)
+{
+	llsim_memory_t *mem;
+	char *addr = (char *) si->si_addr;
+	size_t page_len, first, last;
+	int i;
+
+	for (i = 0; i < LLSIM_MAX_PROTECTED; i++) {
+		mem = __atomic_load_n(&llsim_protected[i], __ATOMIC_ACQUIRE);
+		if (!mem || addr < mem->area || addr >= mem->area + mem->area_len)
+			continue;
+		page_len = LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int);
+		first = ((addr - mem->area) & ~(llsim_os_page - 1)) / page_len;
+		last = (((addr - mem->area) | (llsim_os_page - 1))) / page_len;
+		for (; first <= last && first < mem->nr_pages; first++)
+			llsim_mem_page_changed(mem, first);
+		return;
+	}
+	// not ours, the fault repeats under the previous handler
+	sigaction(SIGSEGV, &llsim_protect_prev, NULL);
+}
+
+static void llsim_protect_install(void)
+{
+	struct sigaction sa;
+
+	llsim_os_page = sysconf(_SC_PAGESIZE);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = llsim_protect_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &llsim_protect_prev);
+}
+
+// the pages of a protected memory live in one mapping, materialized in place
+static void llsim_mem_protect(llsim_memory_t *mem)
+{
+	llsim_memory_t *free_slot;
+	size_t len = (size_t) mem->nr_pages * LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int);
+	int i;
+
+	pthread_once(&llsim_protect_once, llsim_protect_install);
+	mem->area_len = (len + llsim_os_page - 1) & ~(llsim_os_page - 1);
+	mem->area = mmap(NULL, mem->area_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	llsim_assert(mem->area != MAP_FAILED, "ERROR: couldn't map memory %s\n", mem->name);
+	// writes to protected pages are caught by the fault handler instead
+	mem->page_track = LLSIM_PAGE_HASH | LLSIM_PAGE_LIVE;
+	for (i = 0; i < LLSIM_MAX_PROTECTED; i++) {
+		free_slot = NULL;
+		if (__atomic_compare_exchange_n(&llsim_protected[i], &free_slot, mem, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+	}
+	llsim_error("ERROR: more than %d write protected memories\n", LLSIM_MAX_PROTECTED);
+}
+
+static void llsim_mem_unmap(llsim_memory_t *mem)
+{
+	int i;
+
+	for (i = 0; i < LLSIM_MAX_PROTECTED; i++)
+		if (llsim_protected[i] == mem)
+			__atomic_store_n(&llsim_protected[i], NULL, __ATOMIC_RELEASE);
+	munmap(mem->area, mem->area_len);
+	mem->area = NULL;
+}
+
 llsim_memory_t *llsim_allocate_memory(llsim_unit_t *unit, char *name, int bits, int height, int dp)
 {
+	llsim_t *sim = unit->sim;
 	llsim_memory_t *mem;
+	int i;
 
-	llsim_assert(bits <= 32, "ERROR: bits %d not supported", bits);
-	mem = (llsim_memory_t *) llsim_malloc(sizeof(llsim_memory_t));
+	llsim_assert(!sim->finalized, "ERROR: memory %s allocated after llsim_finalize", name);
+	llsim_assert(bits > 0 && bits <= LLSIM_MEM_MAX_BITS, "ERROR: bits %d not supported", bits);
+	mem = (llsim_memory_t *) llsim_malloc(sim, sizeof(llsim_memory_t));
+	mem->sim = sim;
 	mem->entry_size = (bits + 31) / 32;
-	mem->name = (char *) llsim_malloc(strlen(name)+1);
-	strcpy(mem->name, name);
+	mem->name = llsim_intern(sim, name);
+	mem->id = sim->nr_mems++;
 	mem->bits = bits;
 	mem->height = height;
 	mem->dp = dp;
-	mem->data = (int *) llsim_malloc((1+height) * mem->entry_size * sizeof(int));
-	mem->datain = (int *) llsim_malloc(mem->entry_size);
-	mem->dataout = (int *) llsim_malloc(mem->entry_size);
+	mem->nr_ports = dp ? dp : 1;
+	llsim_assert(mem->nr_ports <= LLSIM_MEM_MAX_PORTS, "ERROR: %d ports not supported", mem->nr_ports);
+	mem->collision = LLSIM_MEM_COLLISION_ERROR;
+	mem->bandwidth = mem->entry_size;
+	mem->last_write_clock = -1;
+	mem->nr_pages = (height + LLSIM_MEM_PAGE_ENTRIES - 1) >> LLSIM_MEM_PAGE_SHIFT;
+	mem->pages = (int **) llsim_malloc(sim, mem->nr_pages * sizeof(int *));
+	for (i = 0; i < mem->nr_pages; i++)
+		mem->pages[i] = llsim_zero_page;
+	mem->page_dirty = (char *) llsim_malloc(sim, mem->nr_pages);
+	mem->dirty_pages = (int *) llsim_malloc(sim, mem->nr_pages * sizeof(int));
+	mem->snap_dirty = (int *) llsim_malloc(sim, mem->nr_pages * sizeof(int));
+	mem->page_track = LLSIM_PAGE_HASH | LLSIM_PAGE_SNAP | LLSIM_PAGE_LIVE;
+	if (sim->snapshot_protect)
+		llsim_mem_protect(mem);
+	for (i = 0; i < mem->nr_ports; i++) {
+		mem->port[i].datain = (int *) llsim_malloc(sim, mem->entry_size * sizeof(int));
+		mem->port[i].dataout = (int *) llsim_malloc(sim, mem->entry_size * sizeof(int));
+		mem->port[i].ready = 1;
+		mem->port[i].read_latency = 1;
+		mem->port[i].write_latency = 1;
+		mem->port[i].depth = 1;
+	}
 	mem->next = unit->mems;
 	unit->mems = mem;
 	return mem;
 }
 
-void llsim_mem_inject(llsim_memory_t *memory, int addr, int val, int msb, int lsb)
+int *llsim_mem_materialize(llsim_memory_t *memory, int page)
 {
-	int *p;
+	int page_len = LLSIM_MEM_PAGE_ENTRIES * memory->entry_size * sizeof(int);
 
-	p = memory->data + addr * memory->entry_size;
-	generic_inject_bits((char *) p, val, msb, lsb);
+	if (memory->area)
+		memory->pages[page] = (int *) (memory->area + (size_t) page * page_len);
+	else
+		memory->pages[page] = (int *) llsim_malloc(memory->sim, page_len);
+	return memory->pages[page];
 }
 
-int llsim_mem_extract(llsim_memory_t *memory, int addr, int msb, int lsb)
+// the page has new contents: the state hash and the next snapshot have to look at it
+static void llsim_mem_page_changed(llsim_memory_t *memory, int page)
 {
-	int *p;
+	if (!(memory->page_dirty[page] & LLSIM_PAGE_HASH)) {
+		memory->page_dirty[page] |= LLSIM_PAGE_HASH;
+		memory->dirty_pages[memory->nr_dirty++] = page;
+	}
+	if (!(memory->page_dirty[page] & LLSIM_PAGE_SNAP)) {
+		if (memory->area)
+			llsim_mem_unprotect(memory, page);
+		else
+			llsim_mem_snap_dirty(memory, page);
+	}
+}
 
-	p = memory->data + addr * memory->entry_size;
-	return generic_extract_bits((char *) p,msb,lsb);
+// slow path of llsim_mem_entry_w, the first write to a page since it was last looked at
+int *llsim_mem_page_w(llsim_memory_t *memory, int page)
+{
+	if (memory->pages[page] == llsim_zero_page)
+		llsim_mem_materialize(memory, page);
+	memory->page_dirty[page] |= LLSIM_PAGE_LIVE;
+	llsim_mem_page_changed(memory, page);
+	return memory->pages[page];
 }
 
-void llsim_mem_write(llsim_memory_t *memory, int addr)
+/*
+ * copy a whole entry. entries wider than 32 bits move in 128 bit vectors
+ */
+typedef int llsim_v4si_t __attribute__ ((vector_size (16)));
+
+static inline void llsim_copy_entry(int *dst, int *src, int words)
 {
-	llsim_assert(!memory->write, "ERROR: multiple memory writes to memory %s", memory->name);
-	memory->write = 1;
-	memory->write_addr = addr;
+	llsim_v4si_t v;
+
+	if (words == 1) {
+		*dst = *src;
+		return;
+	}
+	for (; words >= 4; words -= 4, dst += 4, src += 4) {
+		memcpy(&v, src, sizeof(v));
+		memcpy(dst, &v, sizeof(v));
+	}
+	for (; words; words--)
+		*dst++ = *src++;
 }
 
-void llsim_mem_read(llsim_memory_t *memory, int addr)
+/*
+ * bulk copies of n whole entries (n * entry_size words) in or out of a
+ * memory, a page at a time
+ */
+void llsim_mem_inject_array(llsim_memory_t *memory, int addr, const int *vals, int n)
 {
-	llsim_assert(!memory->read, "ERROR: multiple memory reads to memory %s", memory->name);
-	memory->read = 1;
-	memory->read_addr = addr;
+	int chunk;
+
+	llsim_assert(addr >= 0 && n >= 0 && addr + n <= memory->height, "mem %s range %d+%d out of range\n", memory->name, addr, n);
+	while (n) {
+		chunk = LLSIM_MEM_PAGE_ENTRIES - (addr & (LLSIM_MEM_PAGE_ENTRIES - 1));
+		if (chunk > n)
+			chunk = n;
+		memcpy(llsim_mem_entry_w(memory, addr), vals, chunk * memory->entry_size * sizeof(int));
+		vals += chunk * memory->entry_size;
+		addr += chunk;
+		n -= chunk;
+	}
 }
 
-void llsim_mem_set_datain(llsim_memory_t *memory, int val, int msb, int lsb)
+void llsim_mem_extract_array(llsim_memory_t *memory, int addr, int *vals, int n)
 {
-	int *p;
+	int chunk;
 
-	llsim_assert(msb <= 31 && lsb <= 31, "ERROR only <=32 bit memories supported");
-	p = (int *) memory->datain;
-	*p = rbs(*p,val,msb,lsb);
+	llsim_assert(addr >= 0 && n >= 0 && addr + n <= memory->height, "mem %s range %d+%d out of range\n", memory->name, addr, n);
+	while (n) {
+		chunk = LLSIM_MEM_PAGE_ENTRIES - (addr & (LLSIM_MEM_PAGE_ENTRIES - 1));
+		if (chunk > n)
+			chunk = n;
+		memcpy(vals, llsim_mem_entry(memory, addr), chunk * memory->entry_size * sizeof(int));
+		vals += chunk * memory->entry_size;
+		addr += chunk;
+		n -= chunk;
+	}
 }
 
-int llsim_mem_extract_dataout(llsim_memory_t *memory, int msb, int lsb)
+// claim an access slot of a memory shared between concurrently running units
+static void llsim_mem_claim(llsim_memory_t *memory, llsim_unit_t **owner, char *access)
 {
-	int *p;
+	llsim_unit_t *prev;
 
-	llsim_assert(msb <= 31 && lsb <= 31, "ERROR only <=32 bit memories supported");
-	p = (int *) memory->dataout;
-	return sbs(*p,msb,lsb);
+	prev = __atomic_exchange_n(owner, current_unit, __ATOMIC_RELAXED);
+	llsim_assert(prev == NULL, "ERROR: conflicting memory %ss to memory %s by units %s and %s\n",
+		     access, memory->name, prev->name, current_unit->name);
 }
 
-void llsim_run_clock(void)
+void llsim_mem_set_collision(llsim_memory_t *memory, int collision)
 {
-	llsim_unit_t *unit;
-	llsim_unit_registers_t *ur;
-	llsim_memory_t *mem;
-	int read_done, write_done;
-	
-	/*
-	 * run units
-	 */
-	unit = llsim->units;
-	while (unit) {
-		unit->run(unit);
-
-		// memories
-		mem = unit->mems;
-		while (mem) {
-			read_done = mem->read;
-			write_done = mem->write;
-			if (mem->read) {
-				llsim_assert(mem->read_addr < mem->height, "mem %s read address %d out of range\n", mem->name, mem->read_addr);
-				*mem->dataout = mem->data[mem->read_addr];
-				llsim_printf("llsim: clock %d: READ MEM %s addr %d --> %08x\n", llsim->clock, mem->name, mem->read_addr, *mem->dataout);
-				mem->read = 0;
-			}
-			if (mem->write) {
-				llsim_assert(mem->write_addr < mem->height, "mem %s write address %d out of range\n", mem->name, mem->write_addr);
-				mem->data[mem->write_addr] = *mem->datain;
-				llsim_printf("llsim: clock %d: WRITE %08x --> MEM %s addr %d\n", llsim->clock, *mem->datain, mem->name, mem->write_addr);
-				mem->write = 0;
-			}
-			llsim_assert(!(read_done && write_done), "ERROR: simultaneous access to memory %s", mem->name);
-			if (!read_done && !write_done)
-				*mem->dataout = 0xBAADBAAD;
-			mem = mem->next;
-		}
-		unit = unit->next;
-	}
+	memory->collision = collision;
+}
 
-	/*
-	 * copy registers
-	 */
-	unit = llsim->units;
-	while (unit) {
-		ur = unit->regs;
-		while (ur) {
-			memcpy(ur->old, ur->new, ur->size);
-			ur = ur->next;
-		}
-		unit = unit->next;
-	}
+void llsim_mem_set_port_latency(llsim_memory_t *memory, int port, int read_latency, int write_latency, int depth)
+{
+	llsim_mem_port_t *p = &memory->port[port];
+	int i;
+
+	llsim_assert(!memory->sim->finalized, "ERROR: latency of memory %s set after llsim_finalize", memory->name);
+	llsim_mem_check_port(memory, port);
+	llsim_assert(read_latency >= 1 && write_latency >= 1 && depth >= 1,
+		     "ERROR: bad latency %d/%d depth %d for memory %s port %d\n", read_latency, write_latency, depth, memory->name, port);
+	p->read_latency = read_latency;
+	p->write_latency = write_latency;
+	p->depth = depth;
+	if (read_latency == 1 && write_latency == 1)
+		return;
+
+	// all the queue storage the port will ever use
+	llsim_assert(p->queue == NULL, "ERROR: latency of memory %s port %d set twice\n", memory->name, port);
+	p->queue = (llsim_mem_req_t *) llsim_malloc(memory->sim, depth * sizeof(llsim_mem_req_t));
+	for (i = 0; i < depth; i++)
+		p->queue[i].data = (int *) llsim_malloc(memory->sim, memory->entry_size * sizeof(int));
+	memory->queued = 1;
 }
 
-static void llsim_init_units(char *program_name)
+void llsim_mem_set_latency(llsim_memory_t *memory, int read_latency, int write_latency, int depth)
 {
-	llsim->units = NULL;
-	llsim->clock = 0;
-	sp_init(program_name);
+	int i;
+
+	for (i = 0; i < memory->nr_ports; i++)
+		llsim_mem_set_port_latency(memory, i, read_latency, write_latency, depth);
 }
 
-static void llsim_init(char *program_name)
+void llsim_mem_set_bandwidth(llsim_memory_t *memory, int words_per_cycle)
 {
-	llsim = llsim_malloc(sizeof(llsim_t));
-	llsim_init_units(program_name);
+	llsim_assert(words_per_cycle >= 1, "ERROR: bad bandwidth %d for memory %s\n", words_per_cycle, memory->name);
+	memory->bandwidth = words_per_cycle;
 }
 
-static void llsim_init_reset_values(void)
+static void llsim_mem_burst(llsim_memory_t *memory, int port, int write, int addr, int *buf, int n)
 {
-	llsim_unit_t *unit;
-	llsim_register_t *reg;
+	llsim_mem_port_t *p = &memory->port[port];
 
-	/*
-	 * run units
-	 */
-	unit = llsim->units;
-	while (unit) {
-		reg = unit->registers;
-		while (reg) {
-			* (int *) reg->newp = reg->reset_value;
-			reg = reg->next;
-		}
-		unit = unit->next;
-	}
+	llsim_mem_check_port(memory, port);
+	if (memory->sim->pool.threads)
+		llsim_mem_claim(memory, write ? &p->write_unit : &p->read_unit, write ? "write" : "read");
+	llsim_assert(addr >= 0 && n > 0 && addr + n <= memory->height, "mem %s burst %d+%d out of range\n", memory->name, addr, n);
+	llsim_assert(p->ready && !p->read && !p->write && !p->burst, "ERROR: burst to busy memory %s port %d\n", memory->name, port);
+	p->burst = 1;
+	p->burst_write = write;
+	p->burst_addr = addr;
+	p->burst_n = n;
+	p->burst_buf = buf;
+	p->burst_due = -1;
+	p->ready = 0;
+	__atomic_fetch_add(&memory->bursting, 1, __ATOMIC_RELAXED);
 }
 
-void llsim_stop(void)
+void llsim_mem_read_burst_port(llsim_memory_t *memory, int port, int addr, int *buf, int n)
 {
-	stop_sim = 1;
+	llsim_mem_burst(memory, port, 0, addr, buf, n);
 }
 
-int main(int argc, char **argv)
+void llsim_mem_write_burst_port(llsim_memory_t *memory, int port, int addr, int *buf, int n)
 {
-	int i;
+	llsim_mem_burst(memory, port, 1, addr, buf, n);
+}
 
-	llsim_init(argv[1]);
+void llsim_mem_read_burst(llsim_memory_t *memory, int addr, int *buf, int n)
+{
+	llsim_mem_burst(memory, 0, 0, addr, buf, n);
+}
 
-	llsim_printf("llsim: starting simulation\n");
-	llsim->reset = 1;
+void llsim_mem_write_burst(llsim_memory_t *memory, int addr, int *buf, int n)
+{
+	llsim_mem_burst(memory, 0, 1, addr, buf, n);
+}
 
-	// init registers
-	llsim_init_reset_values();
+void llsim_mem_write_port(llsim_memory_t *memory, int port, int addr)
+{
+	llsim_mem_port_t *p = &memory->port[port];
 
-	for (i = 0; i < 5; i++) {
-		llsim_run_clock();
-		llsim->clock++;
-	}
-	llsim->reset = 0;
-	while (!stop_sim) {
-		printf(">>>>> clock %d <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n", llsim->clock);
-		llsim_run_clock();
-		llsim->clock++;
-		/*
-		if ((llsim->clock % 1000000) == 0)
-			printf("clock %d\n", llsim->clock);
-		*/
-	}
-	return 0;
+	llsim_mem_check_port(memory, port);
+	if (memory->sim->pool.threads)
+		llsim_mem_claim(memory, &p->write_unit, "write");
+	llsim_assert(p->ready, "ERROR: write to busy memory %s port %d\n", memory->name, port);
+	llsim_assert(!p->write, "ERROR: multiple memory writes to memory %s", memory->name);
+	p->write = 1;
+	p->write_addr = addr;
+}
+
+void llsim_mem_read_port(llsim_memory_t *memory, int port, int addr)
+{
+	llsim_mem_port_t *p = &memory->port[port];
+
+	llsim_mem_check_port(memory, port);
+	if (memory->sim->pool.threads)
+		llsim_mem_claim(memory, &p->read_unit, "read");
+	llsim_assert(p->ready, "ERROR: read from busy memory %s port %d\n", memory->name, port);
+	llsim_assert(!p->read, "ERROR: multiple memory reads to memory %s", memory->name);
+	p->read = 1;
+	p->read_addr = addr;
+}
+
+void llsim_mem_write(llsim_memory_t *memory, int addr)
+{
+	llsim_mem_write_port(memory, 0, addr);
 }
 
+void llsim_mem_read(llsim_memory_t *memory, int addr)
+{
+	llsim_mem_read_port(memory, 0, addr);
+}
+
+/*
+ * memory access log
+ */
+
+static void memlog_print(FILE *fp, int clock, int type, char *name, int addr, int *data, int words)
+{
+	char hex[LLSIM_MEM_MAX_BITS / 4 + 1];
+	int i;
+
+	// most significant word first. bursts pass their length as words
+	for (i = 0; type <= LLSIM_MEMLOG_WRITE && i < words; i++)
+		sprintf(hex + 8 * i, "%08x", data[words - 1 - i]);
+	if (type == LLSIM_MEMLOG_BURST_READ)
+		fprintf(fp, "llsim: clock %d: BURST READ MEM %s addr %d --> %d entries\n", clock, name, addr, words);
+	else if (type == LLSIM_MEMLOG_BURST_WRITE)
+		fprintf(fp, "llsim: clock %d: BURST WRITE %d entries --> MEM %s addr %d\n", clock, words, name, addr);
+	else if (type == LLSIM_MEMLOG_READ)
+		fprintf(fp, "llsim: clock %d: READ MEM %s addr %d --> %s\n", clock, name, addr, hex);
+	else
+		fprintf(fp, "llsim: clock %d: WRITE %s --> MEM %s addr %d\n", clock, hex, name, addr);
+}
+
+// emit name records for memories allocated since the last drain
+static void memlog_write_names(llsim_t *sim)
+{
+	llsim_unit_t *unit;
+	llsim_memory_t *mem;
+	llsim_memlog_rec_t rec;
+
+	if (sim->memlog.nr_names == sim->nr_mems)
+		return;
+	for (unit = sim->units; unit; unit = unit->next) {
+		for (mem = unit->mems; mem; mem = mem->next) {
+			if (mem->id < sim->memlog.nr_names)
+				continue;
+			memset(&rec, 0, sizeof(rec));
+			rec.type = LLSIM_MEMLOG_NAME;
+			rec.mem = mem->id;
+			rec.addr = mem->entry_size;
+			rec.data = strlen(mem->name);
+			fwrite(&rec, sizeof(rec), 1, sim->memlog.fp);
+			fwrite(mem->name, 1, rec.data, sim->memlog.fp);
+		}
+	}
+	sim->memlog.nr_names = sim->nr_mems;
+}
+
+static void memlog_drain(llsim_t *sim, int from, int to)
+{
+	memlog_write_names(sim);
+	fwrite(sim->memlog.ring + from, sizeof(llsim_memlog_rec_t), to - from, sim->memlog.fp);
+}
+
+static void memlog_wrap(llsim_t *sim)
+{
+	if (sim->memlog.level == LLSIM_MEMLOG_FILE)
+		memlog_drain(sim, 0, LLSIM_MEMLOG_ENTRIES);
+	else
+		sim->memlog.wrapped = 1;
+}
+
+// one record per 32 bit word of the entry
+static inline void memlog_access(llsim_memory_t *mem, int type, int addr, int *data)
+{
+	llsim_t *sim = mem->sim;
+	llsim_memlog_rec_t *rec;
+	int i;
+
+	if (sim->memlog.level == LLSIM_MEMLOG_TEXT) {
+		memlog_print(stdout, sim->clock, type, mem->name, addr, data, mem->entry_size);
+		return;
+	}
+	for (i = 0; i < mem->entry_size; i++) {
+		rec = &sim->memlog.ring[sim->memlog.head];
+		rec->clock = sim->clock;
+		rec->mem = mem->id;
+		rec->type = type | (i << LLSIM_MEMLOG_WORD_SHIFT);
+		rec->addr = addr;
+		rec->data = data[i];
+		sim->memlog.head = (sim->memlog.head + 1) & (LLSIM_MEMLOG_ENTRIES - 1);
+		if (sim->memlog.head == 0)
+			memlog_wrap(sim);
+	}
+}
+
+static void memlog_burst(llsim_memory_t *mem, int type, int addr, int n)
+{
+	llsim_t *sim = mem->sim;
+	llsim_memlog_rec_t *rec;
+
+	if (sim->memlog.level == LLSIM_MEMLOG_TEXT) {
+		memlog_print(stdout, sim->clock, type, mem->name, addr, NULL, n);
+		return;
+	}
+	rec = &sim->memlog.ring[sim->memlog.head];
+	rec->clock = sim->clock;
+	rec->mem = mem->id;
+	rec->type = type;
+	rec->addr = addr;
+	rec->data = n;
+	sim->memlog.head = (sim->memlog.head + 1) & (LLSIM_MEMLOG_ENTRIES - 1);
+	if (sim->memlog.head == 0)
+		memlog_wrap(sim);
+}
+
+void llsim_memlog_open(llsim_t *sim, int level, char *file_name)
+{
+	int version = LLSIM_MEMLOG_VERSION;
+
+	sim->memlog.level = level;
+	if (level != LLSIM_MEMLOG_RING && level != LLSIM_MEMLOG_FILE)
+		return;
+	sim->memlog.file_name = file_name;
+	sim->memlog.fp = fopen(file_name, "w");
+	if (sim->memlog.fp == NULL) {
+		printf("couldn't open file %s\n", file_name);
+		exit(1);
+	}
+	fwrite(LLSIM_MEMLOG_MAGIC, 1, 8, sim->memlog.fp);
+	fwrite(&version, sizeof(version), 1, sim->memlog.fp);
+	sim->memlog.ring = (llsim_memlog_rec_t *) malloc(LLSIM_MEMLOG_ENTRIES * sizeof(llsim_memlog_rec_t));
+	if (sim->memlog.ring == NULL) {
+		printf("out of memory\n");
+		exit(1);
+	}
+	sim->memlog.head = 0;
+	sim->memlog.wrapped = 0;
+	sim->memlog.nr_names = 0;
+}
+
+// write out what the current simulation logged, names included
+static void memlog_flush(llsim_t *sim)
+{
+	if (sim->memlog.fp == NULL)
+		return;
+	if (sim->memlog.wrapped)
+		memlog_drain(sim, sim->memlog.head, LLSIM_MEMLOG_ENTRIES);
+	memlog_drain(sim, 0, sim->memlog.head);
+	sim->memlog.head = 0;
+	sim->memlog.wrapped = 0;
+}
+
+void llsim_memlog_close(llsim_t *sim)
+{
+	if (sim->memlog.fp == NULL)
+		return;
+	memlog_flush(sim);
+	fclose(sim->memlog.fp);
+	sim->memlog.fp = NULL;
+	free(sim->memlog.ring);
+	sim->memlog.ring = NULL;
+	sim->memlog.level = LLSIM_MEMLOG_OFF;
+}
+
+// reproduce the legacy text lines from a binary log
+int llsim_memlog_decode(char *file_name, FILE *out)
+{
+	FILE *fp;
+	char magic[8];
+	char **names;
+	int *widths;
+	int words[LLSIM_MEM_MAX_BITS / 32];
+	llsim_memlog_rec_t rec;
+	int version, i, word, next_word;
+
+	fp = fopen(file_name, "r");
+	if (fp == NULL) {
+		printf("couldn't open file %s\n", file_name);
+		return 1;
+	}
+	if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, LLSIM_MEMLOG_MAGIC, 8) ||
+	    fread(&version, sizeof(version), 1, fp) != 1 || version != LLSIM_MEMLOG_VERSION) {
+		printf("%s: not a memory access log\n", file_name);
+		fclose(fp);
+		return 1;
+	}
+	names = (char **) calloc(1 << 16, sizeof(char *));
+	widths = (int *) calloc(1 << 16, sizeof(int));
+	next_word = 0;
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		if (rec.type == LLSIM_MEMLOG_NAME) {
+			free(names[rec.mem]);
+			names[rec.mem] = malloc(rec.data + 1);
+			widths[rec.mem] = rec.addr;
+			if (fread(names[rec.mem], 1, rec.data, fp) != rec.data)
+				break;
+			names[rec.mem][rec.data] = 0;
+			continue;
+		}
+		if (rec.type == LLSIM_MEMLOG_BURST_READ || rec.type == LLSIM_MEMLOG_BURST_WRITE) {
+			if (names[rec.mem])
+				memlog_print(out, rec.clock, rec.type, names[rec.mem], rec.addr, NULL, rec.data);
+			next_word = 0;
+			continue;
+		}
+		// a flight recorder log may start in the middle of a wide access
+		word = rec.type >> LLSIM_MEMLOG_WORD_SHIFT;
+		if (word != next_word || !names[rec.mem] || word >= widths[rec.mem]) {
+			next_word = 0;
+			continue;
+		}
+		words[word] = rec.data;
+		next_word = word + 1;
+		if (next_word < widths[rec.mem])
+			continue;
+		next_word = 0;
+		memlog_print(out, rec.clock, rec.type & ((1 << LLSIM_MEMLOG_WORD_SHIFT) - 1),
+			     names[rec.mem], rec.addr, words, widths[rec.mem]);
+	}
+	for (i = 0; i < (1 << 16); i++)
+		free(names[i]);
+	free(names);
+	free(widths);
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * state hash log
+ */
+static inline u64 llsim_hash_mix(u64 h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static u64 llsim_hash_bytes(const void *p, int len, u64 seed)
+{
+	const char *c = (const char *) p;
+	u64 h = seed ^ (len * 0x9e3779b97f4a7c15ULL), w;
+
+	for (; len >= 8; len -= 8, c += 8) {
+		memcpy(&w, c, 8);
+		h ^= w * 0x87c37b91114253d5ULL;
+		h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+	}
+	for (w = 0; len; len--)
+		w = (w << 8) | (unsigned char) *c++;
+	return llsim_hash_mix(h ^ w);
+}
+
+static inline u64 llsim_hash_page(llsim_memory_t *mem, int page)
+{
+	return llsim_hash_bytes(mem->pages[page], LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int), page);
+}
+
+static inline u64 llsim_hash_node(u64 left, u64 right)
+{
+	return llsim_hash_mix(left ^ llsim_hash_mix(right + 0x9e3779b97f4a7c15ULL));
+}
+
+static void hashlog_write_name(FILE *fp, char *name)
+{
+	int len = strlen(name);
+
+	fwrite(&len, sizeof(len), 1, fp);
+	fwrite(name, 1, len, fp);
+}
+
+/*
+ * the header describes the record: register blocks, memories and the
+ * named registers inside the blocks, which bisection prints by name
+ */
+static void hashlog_start(llsim_t *sim)
+{
+	llsim_hashlog_t *log = &sim->hashlog;
+	llsim_unit_t *unit;
+	llsim_register_t *reg;
+	llsim_memory_t *mem;
+	int version = LLSIM_HASHLOG_VERSION;
+	int i, j, n, words[3];
+
+	log->rec_size = 2 * sizeof(int) + sizeof(u64) + sim->nr_mems * sizeof(u64);
+	for (i = 0; i < sim->nr_regs; i++)
+		log->rec_size += sim->sched_regs[i]->size;
+	log->rec = (char *) llsim_malloc(sim, log->rec_size);
+
+	fwrite(LLSIM_HASHLOG_MAGIC, 1, 8, log->fp);
+	fwrite(&version, sizeof(version), 1, log->fp);
+	fwrite(&sim->nr_regs, sizeof(int), 1, log->fp);
+	for (i = 0; i < sim->nr_regs; i++) {
+		fwrite(&sim->sched_regs[i]->size, sizeof(int), 1, log->fp);
+		hashlog_write_name(log->fp, sim->sched_regs[i]->name);
+	}
+	fwrite(&sim->nr_mems, sizeof(int), 1, log->fp);
+	for (i = 0; i < sim->nr_mems; i++)
+		hashlog_write_name(log->fp, sim->sched_mems[i]->name);
+	n = 0;
+	for (unit = sim->units; unit; unit = unit->next)
+		for (reg = unit->registers; reg; reg = reg->next)
+			n++;
+	fwrite(&n, sizeof(n), 1, log->fp);
+	for (unit = sim->units; unit; unit = unit->next) {
+		for (reg = unit->registers; reg; reg = reg->next) {
+			// block -1: the register lives outside any block, and outside the record
+			words[0] = -1;
+			for (j = 0; j < sim->nr_regs; j++)
+				if (reg->oldbase == &sim->sched_regs[j]->old)
+					words[0] = j;
+			words[1] = reg->offset;
+			words[2] = reg->bits;
+			fwrite(words, sizeof(int), 3, log->fp);
+			hashlog_write_name(log->fp, reg->unit_name);
+			hashlog_write_name(log->fp, reg->reg_name);
+		}
+	}
+
+	// the running memory hashes start from every page
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		mem->page_hash = (u64 *) llsim_malloc(sim, mem->nr_pages * sizeof(u64));
+		mem->hash = 0;
+		for (j = 0; j < mem->nr_pages; j++) {
+			mem->page_hash[j] = llsim_hash_page(mem, j);
+			mem->hash += mem->page_hash[j];
+			mem->page_dirty[j] &= ~LLSIM_PAGE_HASH;
+		}
+		mem->nr_dirty = 0;
+	}
+}
+
+static void llsim_hashlog_clock(llsim_t *sim)
+{
+	llsim_hashlog_t *log = &sim->hashlog;
+	llsim_memory_t *mem;
+	llsim_unit_registers_t *ur;
+	char *rec;
+	u64 h;
+	int i, j, page;
+
+	if (!log->rec_size)
+		hashlog_start(sim);
+	rec = log->rec + 2 * sizeof(int) + sizeof(u64);
+	h = llsim_hash_mix(sim->clock);
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		for (j = 0; j < mem->nr_dirty; j++) {
+			page = mem->dirty_pages[j];
+			mem->hash -= mem->page_hash[page];
+			mem->page_hash[page] = llsim_hash_page(mem, page);
+			mem->hash += mem->page_hash[page];
+			mem->page_dirty[page] &= ~LLSIM_PAGE_HASH;
+		}
+		mem->nr_dirty = 0;
+		h = llsim_hash_node(h, mem->hash);
+		memcpy(rec, &mem->hash, sizeof(u64));
+		rec += sizeof(u64);
+	}
+	for (i = 0; i < sim->nr_regs; i++) {
+		ur = sim->sched_regs[i];
+		h = llsim_hash_bytes(ur->old, ur->size, h);
+		memcpy(rec, ur->old, ur->size);
+		rec += ur->size;
+	}
+	sim->state_hash = h;
+
+	memcpy(log->rec, &sim->clock, sizeof(int));
+	memset(log->rec + sizeof(int), 0, sizeof(int));
+	memcpy(log->rec + 2 * sizeof(int), &h, sizeof(u64));
+	fwrite(log->rec, 1, log->rec_size, log->fp);
+
+	if (log->nr_leaves == log->max_leaves) {
+		log->max_leaves = log->max_leaves ? 2 * log->max_leaves : 4096;
+		log->leaves = (u64 *) realloc(log->leaves, log->max_leaves * sizeof(u64));
+		llsim_assert(log->leaves != NULL, "out of memory");
+	}
+	log->leaves[log->nr_leaves++] = h;
+}
+
+void llsim_hashlog_open(llsim_t *sim, char *file_name)
+{
+	sim->hashlog.fp = fopen(file_name, "w");
+	if (sim->hashlog.fp == NULL) {
+		printf("couldn't open file %s\n", file_name);
+		exit(1);
+	}
+}
+
+/*
+ * the tree goes after the records, a level at a time from the pairs of
+ * leaves up to the root. a node without a right sibling moves up as is.
+ */
+void llsim_hashlog_close(llsim_t *sim)
+{
+	llsim_hashlog_t *log = &sim->hashlog;
+	llsim_hashlog_trailer_t trailer;
+	u64 *level = log->leaves;
+	int i, n = log->nr_leaves;
+
+	if (log->fp == NULL)
+		return;
+	// a model that never finalized leaves an empty, unreadable log
+	if (!log->rec_size && sim->finalized)
+		hashlog_start(sim);
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.nr_leaves = n;
+	trailer.tree = ftell(log->fp);
+	trailer.records = trailer.tree - (i64) n * log->rec_size;
+	while (n > 1) {
+		for (i = 0; i < n / 2; i++)
+			level[i] = llsim_hash_node(level[2 * i], level[2 * i + 1]);
+		if (n & 1)
+			level[i++] = level[n - 1];
+		n = i;
+		fwrite(level, sizeof(u64), n, log->fp);
+	}
+	memcpy(trailer.magic, LLSIM_HASHLOG_MAGIC, 8);
+	fwrite(&trailer, sizeof(trailer), 1, log->fp);
+	fclose(log->fp);
+	free(log->leaves);
+	memset(log, 0, sizeof(*log));
+}
+
+/*
+ * bisection
+ */
+typedef struct hashlog_field_s {
+	int block, offset, bits;
+	char name[128];
+} hashlog_field_t;
+
+typedef struct hashlog_file_s {
+	char *file_name;
+	FILE *fp;
+	llsim_hashlog_trailer_t trailer;
+	int nr_blocks, nr_mems, nr_fields, rec_size;
+	int *block_size;
+	char **block_name, **mem_name;
+	hashlog_field_t *fields;
+	int reads;
+} hashlog_file_t;
+
+static char *hashlog_read_name(FILE *fp)
+{
+	char *name;
+	int len;
+
+	if (fread(&len, sizeof(len), 1, fp) != 1 || len < 0 || len > 4096)
+		return NULL;
+	name = (char *) calloc(1, len + 1);
+	if (fread(name, 1, len, fp) != len) {
+		free(name);
+		return NULL;
+	}
+	return name;
+}
+
+static int hashlog_load(hashlog_file_t *f)
+{
+	char magic[8], *unit_name, *reg_name;
+	int version, i;
+
+	f->fp = fopen(f->file_name, "r");
+	if (f->fp == NULL) {
+		printf("couldn't open file %s\n", f->file_name);
+		return 1;
+	}
+	if (fread(magic, 1, 8, f->fp) != 8 || memcmp(magic, LLSIM_HASHLOG_MAGIC, 8) ||
+	    fread(&version, sizeof(version), 1, f->fp) != 1 || version != LLSIM_HASHLOG_VERSION ||
+	    fread(&f->nr_blocks, sizeof(int), 1, f->fp) != 1)
+		goto bad;
+	f->block_size = (int *) calloc(f->nr_blocks, sizeof(int));
+	f->block_name = (char **) calloc(f->nr_blocks, sizeof(char *));
+	f->rec_size = 2 * sizeof(int) + sizeof(u64);
+	for (i = 0; i < f->nr_blocks; i++) {
+		if (fread(&f->block_size[i], sizeof(int), 1, f->fp) != 1 || !(f->block_name[i] = hashlog_read_name(f->fp)))
+			goto bad;
+		f->rec_size += f->block_size[i];
+	}
+	if (fread(&f->nr_mems, sizeof(int), 1, f->fp) != 1)
+		goto bad;
+	f->mem_name = (char **) calloc(f->nr_mems, sizeof(char *));
+	for (i = 0; i < f->nr_mems; i++)
+		if (!(f->mem_name[i] = hashlog_read_name(f->fp)))
+			goto bad;
+	f->rec_size += f->nr_mems * sizeof(u64);
+	if (fread(&f->nr_fields, sizeof(int), 1, f->fp) != 1)
+		goto bad;
+	f->fields = (hashlog_field_t *) calloc(f->nr_fields, sizeof(hashlog_field_t));
+	for (i = 0; i < f->nr_fields; i++) {
+		if (fread(&f->fields[i], sizeof(int), 3, f->fp) != 3 ||
+		    !(unit_name = hashlog_read_name(f->fp)) || !(reg_name = hashlog_read_name(f->fp)))
+			goto bad;
+		snprintf(f->fields[i].name, sizeof(f->fields[i].name), "%s.%s", unit_name, reg_name);
+		free(unit_name);
+		free(reg_name);
+	}
+	if (fseek(f->fp, -(long) sizeof(f->trailer), SEEK_END) ||
+	    fread(&f->trailer, sizeof(f->trailer), 1, f->fp) != 1 || memcmp(f->trailer.magic, LLSIM_HASHLOG_MAGIC, 8))
+		goto bad;
+	return 0;
+bad:
+	printf("%s: not a complete state hash log\n", f->file_name);
+	return 1;
+}
+
+static void hashlog_read(hashlog_file_t *f, i64 offset, void *p, int len)
+{
+	f->reads++;
+	if (fseek(f->fp, offset, SEEK_SET) || fread(p, 1, len, f->fp) != len)
+		llsim_error("ERROR: %s truncated\n", f->file_name);
+}
+
+// node idx of a tree level, level 0 being the state hashes in the records
+static u64 hashlog_node(hashlog_file_t *f, int level, i64 idx)
+{
+	i64 offset = f->trailer.tree, n = f->trailer.nr_leaves;
+	u64 h;
+	int l;
+
+	if (level == 0) {
+		hashlog_read(f, f->trailer.records + idx * f->rec_size + 2 * sizeof(int), &h, sizeof(h));
+		return h;
+	}
+	for (l = 1; l < level; l++) {
+		n = (n + 1) / 2;
+		offset += n * sizeof(u64);
+	}
+	hashlog_read(f, offset + idx * sizeof(u64), &h, sizeof(h));
+	return h;
+}
+
+/*
+ * first leaf below node idx of level where the runs differ, among the
+ * first m leaves of both. a node covering the same leaves in both trees
+ * is compared as a whole; only the right edge, where the trees are cut
+ * off, has to be opened up without comparing.
+ */
+static i64 hashlog_first_diff(hashlog_file_t *a, hashlog_file_t *b, int level, i64 idx, i64 m)
+{
+	i64 r;
+
+	if (idx << level >= m)
+		return -1;
+	if ((idx + 1) << level <= m && hashlog_node(a, level, idx) == hashlog_node(b, level, idx))
+		return -1;
+	if (level == 0)
+		return idx;
+	r = hashlog_first_diff(a, b, level - 1, 2 * idx, m);
+	return r >= 0 ? r : hashlog_first_diff(a, b, level - 1, 2 * idx + 1, m);
+}
+
+static void hashlog_print_diff(hashlog_file_t *a, hashlog_file_t *b, i64 idx, FILE *out)
+{
+	char *ra, *rb;
+	int *block_offset, i, j, clock_a, clock_b, off, words, shown;
+
+	ra = (char *) malloc(a->rec_size);
+	rb = (char *) malloc(b->rec_size);
+	hashlog_read(a, a->trailer.records + idx * a->rec_size, ra, a->rec_size);
+	hashlog_read(b, b->trailer.records + idx * b->rec_size, rb, b->rec_size);
+	memcpy(&clock_a, ra, sizeof(int));
+	memcpy(&clock_b, rb, sizeof(int));
+	fprintf(out, "first difference at record %lld, clock %d / %d\n", idx, clock_a, clock_b);
+	if (a->rec_size != b->rec_size || a->nr_blocks != b->nr_blocks || a->nr_mems != b->nr_mems) {
+		fprintf(out, "  the two runs have different models\n");
+		goto out;
+	}
+
+	off = 2 * sizeof(int) + sizeof(u64);
+	for (i = 0; i < a->nr_mems; i++, off += sizeof(u64))
+		if (memcmp(ra + off, rb + off, sizeof(u64)))
+			fprintf(out, "  memory %s\n", a->mem_name[i]);
+	block_offset = (int *) calloc(a->nr_blocks, sizeof(int));
+	for (i = 0; i < a->nr_blocks; i++) {
+		block_offset[i] = off;
+		off += a->block_size[i];
+	}
+	for (i = 0; i < a->nr_blocks; i++) {
+		if (!memcmp(ra + block_offset[i], rb + block_offset[i], a->block_size[i]))
+			continue;
+		shown = 0;
+		for (j = 0; j < a->nr_fields; j++) {
+			if (a->fields[j].block != i)
+				continue;
+			off = block_offset[i] + a->fields[j].offset;
+			words = (a->fields[j].bits + 31) / 32;
+			if (!memcmp(ra + off, rb + off, words * sizeof(int)))
+				continue;
+			fprintf(out, "  %s %08x %08x\n", a->fields[j].name, *(int *) (ra + off), *(int *) (rb + off));
+			shown++;
+		}
+		if (!shown)
+			fprintf(out, "  registers %s, outside the named fields\n", a->block_name[i]);
+	}
+	free(block_offset);
+out:
+	free(ra);
+	free(rb);
+}
+
+int llsim_hashlog_bisect(char *file_name1, char *file_name2, FILE *out)
+{
+	hashlog_file_t a, b;
+	i64 m, idx;
+	int level;
+
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	a.file_name = file_name1;
+	b.file_name = file_name2;
+	if (hashlog_load(&a) || hashlog_load(&b))
+		return 1;
+	m = a.trailer.nr_leaves < b.trailer.nr_leaves ? a.trailer.nr_leaves : b.trailer.nr_leaves;
+	for (level = 0; ((i64) 1 << level) < m; level++)
+		;
+	idx = hashlog_first_diff(&a, &b, level, 0, m);
+	if (idx >= 0)
+		hashlog_print_diff(&a, &b, idx, out);
+	else if (a.trailer.nr_leaves != b.trailer.nr_leaves)
+		fprintf(out, "runs agree for %lld clocks, then %s ends after %lld and %s after %lld\n",
+			m, file_name1, a.trailer.nr_leaves, file_name2, b.trailer.nr_leaves);
+	else
+		fprintf(out, "runs agree for all %lld clocks\n", m);
+	fprintf(out, "%d node reads\n", a.reads);
+	fclose(a.fp);
+	fclose(b.fp);
+	return idx >= 0;
+}
+
+/*
+ * checkpoints
+ */
+void llsim_checkpoint_write(FILE *fp, const void *p, int len)
+{
+	llsim_assert(fwrite(p, 1, len, fp) == len, "ERROR: checkpoint write failed\n");
+}
+
+void llsim_checkpoint_read(FILE *fp, void *p, int len)
+{
+	llsim_assert(fread(p, 1, len, fp) == len, "ERROR: checkpoint truncated\n");
+}
+
+// save and restore walk the state in the same order, through one function
+static inline void checkpoint_io(FILE *fp, int restore, void *p, int len)
+{
+	if (restore)
+		llsim_checkpoint_read(fp, p, len);
+	else
+		llsim_checkpoint_write(fp, p, len);
+}
+
+// one word of the model's shape, which has to match on restore
+static void checkpoint_shape(FILE *fp, int restore, int value, char *what)
+{
+	int saved = value;
+
+	checkpoint_io(fp, restore, &saved, sizeof(saved));
+	llsim_assert(saved == value, "ERROR: checkpoint of a different model: %s %d, not %d\n", what, saved, value);
+}
+
+static int checkpoint_page_empty(llsim_memory_t *mem, int page)
+{
+	int *p = mem->pages[page];
+	int i;
+
+	if (p == llsim_zero_page)
+		return 1;
+	for (i = 0; i < LLSIM_MEM_PAGE_ENTRIES * mem->entry_size; i++)
+		if (p[i])
+			return 0;
+	return 1;
+}
+
+// only materialized pages holding something are saved, as index and data
+static void checkpoint_pages(llsim_memory_t *mem, FILE *fp, int restore)
+{
+	int page_len = LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int);
+	int i, n, page;
+
+	n = 0;
+	for (i = 0; !restore && i < mem->nr_pages; i++)
+		n += !checkpoint_page_empty(mem, i);
+	checkpoint_io(fp, restore, &n, sizeof(n));
+	if (!restore) {
+		for (i = 0; i < mem->nr_pages; i++) {
+			if (checkpoint_page_empty(mem, i))
+				continue;
+			llsim_checkpoint_write(fp, &i, sizeof(i));
+			llsim_checkpoint_write(fp, mem->pages[i], page_len);
+		}
+		return;
+	}
+
+	// pages the checkpoint leaves out are zero, and every page counts as changed
+	for (i = 0; i < mem->nr_pages; i++) {
+		if (mem->pages[i] != llsim_zero_page)
+			memset(llsim_mem_page_w(mem, i), 0, page_len);
+		else
+			llsim_mem_page_changed(mem, i);
+	}
+	for (i = 0; i < n; i++) {
+		llsim_checkpoint_read(fp, &page, sizeof(page));
+		llsim_assert(page >= 0 && page < mem->nr_pages, "ERROR: checkpoint page %d out of range for memory %s\n", page, mem->name);
+		llsim_checkpoint_read(fp, llsim_mem_page_w(mem, page), page_len);
+	}
+}
+
+static void checkpoint_port(llsim_memory_t *mem, llsim_mem_port_t *p, FILE *fp, int restore)
+{
+	int words = mem->entry_size * sizeof(int);
+	int i;
+
+	checkpoint_io(fp, restore, &p->read, sizeof(int));
+	checkpoint_io(fp, restore, &p->read_addr, sizeof(int));
+	checkpoint_io(fp, restore, &p->write, sizeof(int));
+	checkpoint_io(fp, restore, &p->write_addr, sizeof(int));
+	checkpoint_io(fp, restore, p->datain, words);
+	checkpoint_io(fp, restore, p->dataout, words);
+	checkpoint_io(fp, restore, &p->ready, sizeof(int));
+	checkpoint_io(fp, restore, &p->valid, sizeof(int));
+	for (i = 0; p->queue && i < p->depth; i++) {
+		checkpoint_io(fp, restore, &p->queue[i].due, sizeof(int));
+		checkpoint_io(fp, restore, &p->queue[i].write, sizeof(int));
+		checkpoint_io(fp, restore, &p->queue[i].addr, sizeof(int));
+		checkpoint_io(fp, restore, p->queue[i].data, words);
+	}
+	checkpoint_io(fp, restore, &p->qhead, sizeof(int));
+	checkpoint_io(fp, restore, &p->qcount, sizeof(int));
+	checkpoint_io(fp, restore, &p->qlast_due, sizeof(int));
+	checkpoint_io(fp, restore, &p->burst, sizeof(int));
+	checkpoint_io(fp, restore, &p->burst_write, sizeof(int));
+	checkpoint_io(fp, restore, &p->burst_addr, sizeof(int));
+	checkpoint_io(fp, restore, &p->burst_n, sizeof(int));
+	checkpoint_io(fp, restore, &p->burst_due, sizeof(int));
+	// the buffer belongs to the unit, whose restore hook points it back
+	if (restore)
+		p->burst_buf = NULL;
+}
+
+/*
+ * sleep state, with the watched register block and memory by their
+ * place in the schedule, then the unit's own record behind its length
+ */
+static void checkpoint_unit(llsim_unit_t *unit, FILE *fp, int restore)
+{
+	llsim_t *sim = unit->sim;
+	int i, regs, mem, len;
+	long start, end;
+
+	regs = mem = -1;
+	for (i = 0; i < sim->nr_regs; i++)
+		if (sim->sched_regs[i] == unit->wake_regs)
+			regs = i;
+	for (i = 0; i < sim->nr_mems; i++)
+		if (sim->sched_mems[i] == unit->wake_mem)
+			mem = i;
+	checkpoint_io(fp, restore, &unit->asleep, sizeof(int));
+	checkpoint_io(fp, restore, &unit->wake_clock, sizeof(int));
+	checkpoint_io(fp, restore, &unit->wake_offset, sizeof(int));
+	checkpoint_io(fp, restore, &unit->wake_size, sizeof(int));
+	checkpoint_io(fp, restore, &regs, sizeof(int));
+	checkpoint_io(fp, restore, &mem, sizeof(int));
+	if (restore) {
+		llsim_assert(regs >= -1 && regs < sim->nr_regs && mem >= -1 && mem < sim->nr_mems,
+			     "ERROR: checkpoint of unit %s damaged\n", unit->name);
+		unit->wake_regs = regs < 0 ? NULL : sim->sched_regs[regs];
+		unit->wake_mem = mem < 0 ? NULL : sim->sched_mems[mem];
+	}
+
+	if (!restore) {
+		len = 0;
+		start = ftell(fp);
+		llsim_checkpoint_write(fp, &len, sizeof(len));
+		if (unit->save)
+			unit->save(unit, fp);
+		end = ftell(fp);
+		len = end - start - sizeof(len);
+		fseek(fp, start, SEEK_SET);
+		llsim_checkpoint_write(fp, &len, sizeof(len));
+		fseek(fp, end, SEEK_SET);
+		return;
+	}
+	llsim_checkpoint_read(fp, &len, sizeof(len));
+	start = ftell(fp);
+	if (unit->restore)
+		unit->restore(unit, fp);
+	end = ftell(fp);
+	llsim_assert(end - start == len, "ERROR: unit %s restored %ld of its %d checkpoint bytes\n", unit->name, end - start, len);
+}
+
+static void checkpoint_state(llsim_t *sim, FILE *fp, int restore)
+{
+	llsim_unit_registers_t *ur;
+	llsim_memory_t *mem;
+	int i, j, same;
+
+	checkpoint_shape(fp, restore, sim->nr_units, "units");
+	checkpoint_shape(fp, restore, sim->nr_regs, "register blocks");
+	for (i = 0; i < sim->nr_regs; i++)
+		checkpoint_shape(fp, restore, sim->sched_regs[i]->size, sim->sched_regs[i]->name);
+	checkpoint_shape(fp, restore, sim->nr_mems, "memories");
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		checkpoint_shape(fp, restore, mem->bits, mem->name);
+		checkpoint_shape(fp, restore, mem->height, mem->name);
+		checkpoint_shape(fp, restore, mem->nr_ports, mem->name);
+		for (j = 0; j < mem->nr_ports; j++)
+			checkpoint_shape(fp, restore, mem->port[j].queue ? mem->port[j].depth : 0, mem->name);
+	}
+
+	checkpoint_io(fp, restore, &sim->clock, sizeof(int));
+	checkpoint_io(fp, restore, &sim->reset, sizeof(int));
+	checkpoint_io(fp, restore, &sim->runctl.insts, sizeof(int));
+
+	// between clocks new is normally a copy of old, and then left out
+	for (i = 0; i < sim->nr_regs; i++) {
+		ur = sim->sched_regs[i];
+		same = !memcmp(ur->old, ur->new, ur->size);
+		checkpoint_io(fp, restore, ur->old, ur->size);
+		checkpoint_io(fp, restore, &same, sizeof(same));
+		if (same && restore)
+			memcpy(ur->new, ur->old, ur->size);
+		else if (!same)
+			checkpoint_io(fp, restore, ur->new, ur->size);
+	}
+
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		checkpoint_io(fp, restore, &mem->last_write_clock, sizeof(int));
+		checkpoint_io(fp, restore, &mem->bursting, sizeof(int));
+		checkpoint_pages(mem, fp, restore);
+		for (j = 0; j < mem->nr_ports; j++)
+			checkpoint_port(mem, &mem->port[j], fp, restore);
+	}
+
+	for (i = 0; i < sim->nr_units; i++)
+		checkpoint_unit(sim->sched_units[i].unit, fp, restore);
+}
+
+/*
+ * the checkpoint is written next to its file and renamed over it, so a
+ * run killed while saving still has the previous one
+ */
+void llsim_checkpoint_save(llsim_t *sim, char *file_name)
+{
+	char tmp_name[PATH_MAX];
+	int version = LLSIM_CHECKPOINT_VERSION;
+	FILE *fp;
+
+	llsim_assert(sim->finalized, "ERROR: checkpoint of a simulation before llsim_init\n");
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+	fp = fopen(tmp_name, "w");
+	if (fp == NULL) {
+		printf("couldn't open file %s\n", tmp_name);
+		exit(1);
+	}
+	llsim_checkpoint_write(fp, LLSIM_CHECKPOINT_MAGIC, 8);
+	llsim_checkpoint_write(fp, &version, sizeof(version));
+	checkpoint_state(sim, fp, 0);
+	llsim_assert(fflush(fp) == 0 && fsync(fileno(fp)) == 0, "ERROR: checkpoint write failed\n");
+	fclose(fp);
+	llsim_assert(rename(tmp_name, file_name) == 0, "ERROR: couldn't rename %s to %s\n", tmp_name, file_name);
+}
+
+void llsim_checkpoint_restore(llsim_t *sim, char *file_name)
+{
+	llsim_memory_t *mem;
+	char magic[8];
+	int version, i, j;
+	FILE *fp;
+
+	llsim_assert(sim->finalized, "ERROR: checkpoint restored before llsim_init\n");
+	fp = fopen(file_name, "r");
+	if (fp == NULL) {
+		printf("couldn't open file %s\n", file_name);
+		exit(1);
+	}
+	llsim_checkpoint_read(fp, magic, 8);
+	llsim_checkpoint_read(fp, &version, sizeof(version));
+	llsim_assert(memcmp(magic, LLSIM_CHECKPOINT_MAGIC, 8) == 0 && version == LLSIM_CHECKPOINT_VERSION,
+		     "ERROR: %s is not a version %d checkpoint\n", file_name, LLSIM_CHECKPOINT_VERSION);
+	checkpoint_state(sim, fp, 1);
+	llsim_assert(fgetc(fp) == EOF, "ERROR: %s has data past the checkpoint\n", file_name);
+	fclose(fp);
+
+	sim->nr_asleep = 0;
+	for (i = 0; i < sim->nr_units; i++)
+		sim->nr_asleep += sim->sched_units[i].unit->asleep;
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		for (j = 0; j < mem->nr_ports; j++)
+			llsim_assert(!mem->port[j].burst || mem->port[j].burst_buf,
+				     "ERROR: burst on memory %s port %d restored without its buffer\n", mem->name, j);
+	}
+}
+
+// llsim_resume saves to file_name every period clocks
+void llsim_checkpoint_every(llsim_t *sim, int period, char *file_name)
+{
+	sim->checkpoint_period = period;
+	sim->checkpoint_file = llsim_malloc(sim, strlen(file_name) + 1);
+	strcpy(sim->checkpoint_file, file_name);
+}
+
+/*
+ * memory snapshots
+ */
+static int *snap_page_copy(llsim_memory_t *mem, int *src)
+{
+	int page_len = LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int);
+	llsim_snap_page_t *sp;
+
+	if (src == llsim_zero_page)
+		return llsim_zero_page;
+	sp = mem->snap_free;
+	if (sp)
+		mem->snap_free = sp->next;
+	else
+		sp = (llsim_snap_page_t *) llsim_malloc(mem->sim, sizeof(llsim_snap_page_t) + page_len);
+	sp->ref = 1;
+	memcpy(sp->data, src, page_len);
+	return sp->data;
+}
+
+static inline llsim_snap_page_t *snap_page(int *data)
+{
+	return (llsim_snap_page_t *) ((char *) data - offsetof(llsim_snap_page_t, data));
+}
+
+static void snap_page_ref(int *data)
+{
+	if (data != llsim_zero_page)
+		snap_page(data)->ref++;
+}
+
+static void snap_page_unref(llsim_memory_t *mem, int *data)
+{
+	llsim_snap_page_t *sp;
+
+	if (data == llsim_zero_page)
+		return;
+	sp = snap_page(data);
+	if (--sp->ref == 0) {
+		sp->next = mem->snap_free;
+		mem->snap_free = sp;
+	}
+}
+
+// the contents match snap_base again: forget the changed pages, and protect them
+static void snap_settle(llsim_memory_t *mem)
+{
+	char *start;
+	size_t len;
+	int i, page;
+
+	for (i = 0; i < mem->nr_snap_dirty; i++) {
+		page = mem->snap_dirty[i];
+		mem->page_dirty[page] &= ~LLSIM_PAGE_SNAP;
+		if (mem->area) {
+			llsim_mem_page_range(mem, page, &start, &len);
+			mprotect(start, len, PROT_READ);
+		}
+	}
+	mem->nr_snap_dirty = 0;
+}
+
+// writes to the memories of the simulation are caught by protecting their pages
+void llsim_snapshot_protect(llsim_t *sim)
+{
+	llsim_assert(sim->nr_mems == 0, "ERROR: llsim_snapshot_protect called after memories were allocated\n");
+	sim->snapshot_protect = 1;
+}
+
+/*
+ * snap_base is brought up to date by copying the pages changed since the
+ * last snapshot, and the snapshot takes a reference to all of its pages
+ */
+llsim_snapshot_t *llsim_snapshot(llsim_t *sim)
+{
+	llsim_snapshot_t *snap;
+	llsim_memory_t *mem;
+	int i, j, page;
+
+	llsim_assert(sim->finalized, "ERROR: snapshot of a simulation before llsim_init\n");
+	snap = (llsim_snapshot_t *) calloc(1, sizeof(llsim_snapshot_t));
+	llsim_assert(snap != NULL, "out of memory");
+	snap->pages = (int ***) calloc(sim->nr_mems, sizeof(int **));
+	llsim_assert(snap->pages != NULL, "out of memory");
+	snap->sim = sim;
+	snap->clock = sim->clock;
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		if (!mem->snap_base) {
+			mem->snap_base = (int **) llsim_malloc(sim, mem->nr_pages * sizeof(int *));
+			for (j = 0; j < mem->nr_pages; j++)
+				mem->snap_base[j] = snap_page_copy(mem, mem->pages[j]);
+			if (mem->area)
+				mprotect(mem->area, mem->area_len, PROT_READ);
+		} else {
+			for (j = 0; j < mem->nr_snap_dirty; j++) {
+				page = mem->snap_dirty[j];
+				snap_page_unref(mem, mem->snap_base[page]);
+				mem->snap_base[page] = snap_page_copy(mem, mem->pages[page]);
+			}
+		}
+		snap_settle(mem);
+
+		snap->pages[i] = (int **) malloc(mem->nr_pages * sizeof(int *));
+		llsim_assert(snap->pages[i] != NULL, "out of memory");
+		memcpy(snap->pages[i], mem->snap_base, mem->nr_pages * sizeof(int *));
+		for (j = 0; j < mem->nr_pages; j++)
+			snap_page_ref(mem->snap_base[j]);
+	}
+	snap->next = sim->snapshots;
+	sim->snapshots = snap;
+	return snap;
+}
+
+/*
+ * only pages changed since snap_base, or that differ between snap_base
+ * and the snapshot, are copied back
+ */
+void llsim_snapshot_restore(llsim_snapshot_t *snap)
+{
+	llsim_t *sim = snap->sim;
+	llsim_memory_t *mem;
+	int **pages;
+	int i, j, page_len;
+
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		pages = snap->pages[i];
+		page_len = LLSIM_MEM_PAGE_ENTRIES * mem->entry_size * sizeof(int);
+		for (j = 0; j < mem->nr_pages; j++) {
+			if (!(mem->page_dirty[j] & LLSIM_PAGE_SNAP) && mem->snap_base[j] == pages[j])
+				continue;
+			if (pages[j] != llsim_zero_page)
+				memcpy(llsim_mem_page_w(mem, j), pages[j], page_len);
+			else if (mem->pages[j] != llsim_zero_page)
+				memset(llsim_mem_page_w(mem, j), 0, page_len);
+			snap_page_ref(pages[j]);
+			snap_page_unref(mem, mem->snap_base[j]);
+			mem->snap_base[j] = pages[j];
+		}
+		snap_settle(mem);
+	}
+}
+
+void llsim_snapshot_free(llsim_snapshot_t *snap)
+{
+	llsim_t *sim = snap->sim;
+	llsim_snapshot_t **prev;
+	int i, j;
+
+	for (prev = &sim->snapshots; *prev != snap; prev = &(*prev)->next)
+		;
+	*prev = snap->next;
+	for (i = 0; i < sim->nr_mems; i++) {
+		for (j = 0; j < sim->sched_mems[i]->nr_pages; j++)
+			snap_page_unref(sim->sched_mems[i], snap->pages[i][j]);
+		free(snap->pages[i]);
+	}
+	free(snap->pages);
+	free(snap);
+}
+
+// an entry of memory as of the snapshot, read only
+int *llsim_snapshot_entry(llsim_snapshot_t *snap, llsim_memory_t *memory, int addr)
+{
+	int i;
+
+	llsim_mem_check_addr(memory, addr);
+	for (i = 0; snap->sim->sched_mems[i] != memory; i++)
+		;
+	return snap->pages[i][addr >> LLSIM_MEM_PAGE_SHIFT] + (addr & (LLSIM_MEM_PAGE_ENTRIES - 1)) * memory->entry_size;
+}
+
+/*
+ * run control: the first reason to stop in a clock is the one reported
+ */
+static void llsim_halt(llsim_t *sim, int reason)
+{
+	if (!sim->stop)
+		sim->stop = reason;
+}
+
+static void llsim_watch_check(llsim_memory_t *mem, int addr, int n)
+{
+	int i;
+
+	for (i = addr; i < addr + n; i++) {
+		if (mem->watch[i >> 5] & (1u << (i & 31))) {
+			llsim_printf("llsim: clock %d: watchpoint: write to %s addr %d\n", mem->sim->clock, mem->name, i);
+			llsim_halt(mem->sim, LLSIM_STOP_WATCH);
+			return;
+		}
+	}
+}
+
+static inline void llsim_resolve_read(llsim_memory_t *mem, llsim_mem_port_t *p)
+{
+	llsim_assert((unsigned int) p->read_addr < mem->height, "mem %s read address %d out of range\n", mem->name, p->read_addr);
+	llsim_copy_entry(p->dataout, llsim_mem_entry(mem, p->read_addr), mem->entry_size);
+	p->valid = 1;
+	if (mem->sim->memlog.level)
+		memlog_access(mem, LLSIM_MEMLOG_READ, p->read_addr, p->dataout);
+	llsim_event(mem->sim, NULL, LLSIM_EVENT_MEM, .mem = mem, .port = p - mem->port,
+		    .addr = p->read_addr, .data = p->dataout, .n = 1);
+}
+
+static inline void llsim_resolve_write(llsim_memory_t *mem, llsim_mem_port_t *p)
+{
+	llsim_assert((unsigned int) p->write_addr < mem->height, "mem %s write address %d out of range\n", mem->name, p->write_addr);
+	llsim_copy_entry(llsim_mem_entry_w(mem, p->write_addr), p->datain, mem->entry_size);
+	mem->last_write_clock = mem->sim->clock;
+	p->valid = 0;
+	if (__builtin_expect(mem->watch != NULL, 0))
+		llsim_watch_check(mem, p->write_addr, 1);
+	if (mem->sim->memlog.level)
+		memlog_access(mem, LLSIM_MEMLOG_WRITE, p->write_addr, p->datain);
+	llsim_event(mem->sim, NULL, LLSIM_EVENT_MEM, .mem = mem, .port = p - mem->port,
+		    .write = 1, .addr = p->write_addr, .data = p->datain, .n = 1);
+}
+
+static inline void llsim_resolve_idle(llsim_memory_t *mem, llsim_mem_port_t *p)
+{
+	int i;
+
+	for (i = 0; i < mem->entry_size; i++)
+		p->dataout[i] = 0xBAADBAAD;
+	p->valid = 0;
+}
+
+static void llsim_resolve_ports(llsim_memory_t *mem)
+{
+	llsim_mem_port_t *p, *q;
+	int i, j;
+
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		llsim_assert(!(p->read && p->write), "ERROR: simultaneous access to memory %s port %d", mem->name, i);
+		if (mem->collision != LLSIM_MEM_COLLISION_ERROR || !p->write)
+			continue;
+		for (j = 0; j < mem->nr_ports; j++) {
+			q = &mem->port[j];
+			llsim_assert(j == i || !((q->read && q->read_addr == p->write_addr) || (q->write && q->write_addr == p->write_addr)),
+				     "ERROR: ports %d and %d of memory %s collide at address %d\n", i, j, mem->name, p->write_addr);
+		}
+	}
+
+	// writes go in port order, so the highest port wins
+	if (mem->collision == LLSIM_MEM_COLLISION_WRITE_FIRST)
+		for (i = 0; i < mem->nr_ports; i++)
+			if (mem->port[i].write)
+				llsim_resolve_write(mem, &mem->port[i]);
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		if (p->read)
+			llsim_resolve_read(mem, p);
+		else if (!p->write)
+			llsim_resolve_idle(mem, p);
+	}
+	if (mem->collision != LLSIM_MEM_COLLISION_WRITE_FIRST)
+		for (i = 0; i < mem->nr_ports; i++)
+			if (mem->port[i].write)
+				llsim_resolve_write(mem, &mem->port[i]);
+
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		p->read = 0;
+		p->write = 0;
+		p->read_unit = NULL;
+		p->write_unit = NULL;
+	}
+}
+
+/*
+ * a burst takes its latency plus one cycle per bandwidth worth of words,
+ * after whatever is queued ahead of it, and lands in one go
+ */
+static void llsim_resolve_burst(llsim_memory_t *mem, llsim_mem_port_t *p)
+{
+	llsim_t *sim = mem->sim;
+	int words;
+
+	if (p->burst_due < 0) {
+		words = p->burst_n * mem->entry_size;
+		p->burst_due = sim->clock + ((p->burst_write ? p->write_latency : p->read_latency) - 1 +
+					       (words + mem->bandwidth - 1) / mem->bandwidth - 1) * mem->period;
+		if (p->qcount && p->burst_due <= p->qlast_due)
+			p->burst_due = p->qlast_due + mem->period;
+	}
+	if (p->burst_due != sim->clock)
+		return;
+
+	if (p->burst_write) {
+		llsim_mem_inject_array(mem, p->burst_addr, p->burst_buf, p->burst_n);
+		mem->last_write_clock = sim->clock;
+		if (mem->watch)
+			llsim_watch_check(mem, p->burst_addr, p->burst_n);
+	} else {
+		llsim_mem_extract_array(mem, p->burst_addr, p->burst_buf, p->burst_n);
+	}
+	if (sim->memlog.level)
+		memlog_burst(mem, p->burst_write ? LLSIM_MEMLOG_BURST_WRITE : LLSIM_MEMLOG_BURST_READ, p->burst_addr, p->burst_n);
+	llsim_event(sim, NULL, LLSIM_EVENT_MEM, .mem = mem, .port = p - mem->port,
+		    .write = p->burst_write, .addr = p->burst_addr, .data = p->burst_buf, .n = p->burst_n);
+	p->burst = 0;
+	mem->bursting--;
+}
+
+/*
+ * ports with latency or bursts: this cycle's requests join the port
+ * queues, and the requests due this cycle stand in for them while the
+ * ports resolve as usual. a due write lends its captured data as datain
+ * for the duration. bursts resolve after the single accesses.
+ */
+static void llsim_resolve_queued(llsim_memory_t *mem)
+{
+	llsim_t *sim = mem->sim;
+	llsim_mem_port_t *p;
+	llsim_mem_req_t *r, *due[LLSIM_MEM_MAX_PORTS];
+	int *data, i;
+
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		due[i] = NULL;
+		if (!p->queue)
+			continue;
+		if (p->read || p->write) {
+			llsim_assert(!(p->read && p->write), "ERROR: simultaneous access to memory %s port %d", mem->name, i);
+			llsim_assert(p->qcount < p->depth, "ERROR: request to memory %s port %d while not ready\n", mem->name, i);
+			r = &p->queue[(p->qhead + p->qcount) % p->depth];
+			r->write = p->write;
+			r->addr = p->write ? p->write_addr : p->read_addr;
+			r->due = sim->clock + ((p->write ? p->write_latency : p->read_latency) - 1) * mem->period;
+			if (p->qcount && r->due <= p->qlast_due)
+				r->due = p->qlast_due + mem->period;
+			if (p->write)
+				llsim_copy_entry(r->data, p->datain, mem->entry_size);
+			p->qlast_due = r->due;
+			p->qcount++;
+			p->read = 0;
+			p->write = 0;
+		}
+		if (!p->qcount || p->queue[p->qhead].due != sim->clock)
+			continue;
+		r = due[i] = &p->queue[p->qhead];
+		p->qhead = (p->qhead + 1) % p->depth;
+		p->qcount--;
+		if (r->write) {
+			p->write = 1;
+			p->write_addr = r->addr;
+			data = p->datain;
+			p->datain = r->data;
+			r->data = data;
+		} else {
+			p->read = 1;
+			p->read_addr = r->addr;
+		}
+	}
+
+	llsim_resolve_ports(mem);
+
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		if (due[i] && due[i]->write) {
+			data = p->datain;
+			p->datain = due[i]->data;
+			due[i]->data = data;
+		}
+		if (p->burst)
+			llsim_resolve_burst(mem, p);
+		p->ready = !p->burst && p->qcount < p->depth;
+	}
+}
+
+static inline void llsim_resolve_memory(llsim_memory_t *mem)
+{
+	llsim_mem_port_t *p = &mem->port[0];
+
+	if (mem->queued || mem->bursting) {
+		llsim_resolve_queued(mem);
+		return;
+	}
+	if (mem->nr_ports > 1) {
+		llsim_resolve_ports(mem);
+		return;
+	}
+	llsim_assert(!(p->read && p->write), "ERROR: simultaneous access to memory %s", mem->name);
+	if (p->read)
+		llsim_resolve_read(mem, p);
+	else if (p->write)
+		llsim_resolve_write(mem, p);
+	else
+		llsim_resolve_idle(mem, p);
+	p->read = 0;
+	p->write = 0;
+	p->read_unit = NULL;
+	p->write_unit = NULL;
+}
+
+static void llsim_pool_run_units(llsim_t *sim)
+{
+	llsim_sched_unit_t *su;
+	int i;
+
+	while ((i = __atomic_fetch_add(&sim->pool.next, 1, __ATOMIC_RELAXED)) < sim->nr_units) {
+		su = &sim->sched_units[i];
+		if (su->unit->asleep || !su->edge)
+			continue;
+		current_unit = su->unit;
+		su->run(su->unit);
+	}
+}
+
+static void *llsim_pool_worker(void *arg)
+{
+	llsim_t *sim = (llsim_t *) arg;
+
+	llsim_current = sim;
+	for (;;) {
+		pthread_barrier_wait(&sim->pool.start);
+		if (sim->pool.quit)
+			break;
+		llsim_pool_run_units(sim);
+		pthread_barrier_wait(&sim->pool.done);
+	}
+	return NULL;
+}
+
+static void llsim_pool_start(llsim_t *sim)
+{
+	int i;
+
+	sim->pool.threads = (pthread_t *) calloc(sim->pool.nr_threads - 1, sizeof(pthread_t));
+	llsim_assert(sim->pool.threads != NULL, "out of memory");
+	pthread_barrier_init(&sim->pool.start, NULL, sim->pool.nr_threads);
+	pthread_barrier_init(&sim->pool.done, NULL, sim->pool.nr_threads);
+	pthread_mutex_init(&sim->pool.lock, NULL);
+	for (i = 0; i < sim->pool.nr_threads - 1; i++)
+		llsim_assert(pthread_create(&sim->pool.threads[i], NULL, llsim_pool_worker, sim) == 0,
+			     "ERROR: couldn't start worker thread %d\n", i);
+}
+
+void llsim_parallel(llsim_t *sim, int nr_threads)
+{
+	llsim_assert(!sim->finalized, "ERROR: llsim_parallel called after llsim_finalize\n");
+	sim->pool.nr_threads = nr_threads;
+}
+
+void llsim_parallel_stop(llsim_t *sim)
+{
+	int i;
+
+	if (!sim->pool.threads)
+		return;
+	sim->pool.quit = 1;
+	pthread_barrier_wait(&sim->pool.start);
+	for (i = 0; i < sim->pool.nr_threads - 1; i++)
+		pthread_join(sim->pool.threads[i], NULL);
+	pthread_barrier_destroy(&sim->pool.start);
+	pthread_barrier_destroy(&sim->pool.done);
+	pthread_mutex_destroy(&sim->pool.lock);
+	free(sim->pool.threads);
+	sim->pool.threads = NULL;
+	sim->pool.quit = 0;
+}
+
+/*
+ * levelize comb blocks: a depth first walk from each block through the
+ * drivers of the wires it reads emits every block after all of its
+ * drivers. reaching a block that is still on the walk is a loop, which is
+ * reported with the wires around it.
+ */
+#define LLSIM_COMB_UNVISITED	0
+#define LLSIM_COMB_ON_PATH	1
+#define LLSIM_COMB_DONE		2
+
+static void llsim_comb_loop(llsim_comb_t *comb, llsim_wire_t *wire)
+{
+	llsim_comb_t *c;
+
+	printf("llsim: combinational loop: %s.%s", wire->unit_name, wire->wire_name);
+	for (c = comb; c != wire->driver; c = c->parent)
+		printf(" -> %s.%s", c->parent_wire->unit_name, c->parent_wire->wire_name);
+	printf(" -> %s.%s\n", wire->unit_name, wire->wire_name);
+	llsim_error("ERROR: combinational loop through comb %s.%s\n", comb->unit->name, comb->name);
+}
+
+static int llsim_order_comb(llsim_t *sim, llsim_comb_t *comb, int n)
+{
+	llsim_comb_read_t *read;
+	llsim_comb_t *driver;
+
+	comb->mark = LLSIM_COMB_ON_PATH;
+	for (read = comb->reads; read; read = read->next) {
+		driver = read->wire->driver;
+		llsim_assert(driver != NULL, "ERROR: wire %s.%s read by %s.%s is never driven\n",
+			     read->wire->unit_name, read->wire->wire_name, comb->unit->name, comb->name);
+		if (driver->mark == LLSIM_COMB_ON_PATH)
+			llsim_comb_loop(comb, read->wire);
+		if (driver->mark == LLSIM_COMB_UNVISITED) {
+			driver->parent = comb;
+			driver->parent_wire = read->wire;
+			n = llsim_order_comb(sim, driver, n);
+		}
+	}
+	comb->mark = LLSIM_COMB_DONE;
+	sim->sched_combs[n++] = comb;
+	return n;
+}
+
+static void llsim_order_combs(llsim_t *sim)
+{
+	llsim_unit_t *unit;
+	llsim_comb_t *comb;
+	int n = 0;
+
+	sim->sched_combs = (llsim_comb_t **) llsim_malloc(sim, sim->nr_combs * sizeof(llsim_comb_t *));
+	for (unit = sim->units; unit; unit = unit->next)
+		for (comb = unit->combs; comb; comb = comb->next)
+			if (comb->mark == LLSIM_COMB_UNVISITED)
+				n = llsim_order_comb(sim, comb, n);
+}
+
+/*
+ * freeze the unit, memory, register block and comb lists into the flat
+ * arrays walked by llsim_run_clock. nothing may be registered afterwards.
+ */
+void llsim_finalize(llsim_t *sim)
+{
+	llsim_unit_t *unit;
+	llsim_memory_t *mem;
+	llsim_unit_registers_t *ur;
+	llsim_sched_unit_t *su;
+	int nm, nr;
+
+	llsim_assert(!sim->finalized, "ERROR: llsim_finalize called twice");
+	sim->sched_units = (llsim_sched_unit_t *) llsim_malloc(sim, sim->nr_units * sizeof(llsim_sched_unit_t));
+	sim->sched_mems = (llsim_memory_t **) llsim_malloc(sim, sim->nr_mems * sizeof(llsim_memory_t *));
+	sim->sched_regs = (llsim_unit_registers_t **) llsim_malloc(sim, sim->nr_regs * sizeof(llsim_unit_registers_t *));
+
+	su = sim->sched_units;
+	nm = nr = 0;
+	for (unit = sim->units; unit; unit = unit->next, su++) {
+		su->run = unit->run;
+		su->unit = unit;
+		su->edge = 1;
+		su->mem_first = nm;
+		for (mem = unit->mems; mem; mem = mem->next) {
+			if (!mem->period) {
+				mem->period = unit->period;
+				mem->phase = unit->phase;
+			}
+			mem->edge = 1;
+			sim->sched_mems[nm++] = mem;
+		}
+		su->mem_count = nm - su->mem_first;
+		su->reg_first = nr;
+		for (ur = unit->regs; ur; ur = ur->next)
+			sim->sched_regs[nr++] = ur;
+		su->reg_count = nr - su->reg_first;
+	}
+	llsim_order_combs(sim);
+	sim->finalized = 1;
+
+	// a single unit gains nothing from the pool
+	if (sim->pool.nr_threads > 1 && sim->nr_units > 1)
+		llsim_pool_start(sim);
+}
+
+/*
+ * clock domains
+ */
+void llsim_set_clock(llsim_unit_t *unit, int period, int phase)
+{
+	llsim_assert(!unit->sim->finalized, "ERROR: clock of unit %s set after llsim_finalize", unit->name);
+	llsim_assert(period >= 1 && phase >= 0 && phase < period, "ERROR: bad clock %d/%d for unit %s\n", period, phase, unit->name);
+	unit->period = period;
+	unit->phase = phase;
+	if (period > 1)
+		unit->sim->multiclock = 1;
+}
+
+void llsim_mem_set_clock(llsim_memory_t *memory, int period, int phase)
+{
+	llsim_assert(!memory->sim->finalized, "ERROR: clock of memory %s set after llsim_finalize", memory->name);
+	llsim_assert(period >= 1 && phase >= 0 && phase < period, "ERROR: bad clock %d/%d for memory %s\n", period, phase, memory->name);
+	memory->period = period;
+	memory->phase = phase;
+	if (period > 1)
+		memory->sim->multiclock = 1;
+}
+
+// units and memories with an edge on this tick
+static void llsim_mark_edges(llsim_t *sim)
+{
+	llsim_sched_unit_t *su;
+	llsim_memory_t *mem;
+	int i;
+
+	for (i = 0; i < sim->nr_units; i++) {
+		su = &sim->sched_units[i];
+		su->edge = sim->clock % su->unit->period == su->unit->phase;
+	}
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		mem->edge = sim->clock % mem->period == mem->phase;
+	}
+}
+
+/*
+ * sleep and wake
+ */
+static void llsim_fall_asleep(llsim_unit_t *unit)
+{
+	if (!unit->asleep) {
+		unit->asleep = 1;
+		__atomic_fetch_add(&unit->sim->nr_asleep, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void llsim_sleep_until(llsim_unit_t *unit, int clock)
+{
+	llsim_assert(clock > unit->sim->clock, "ERROR: unit %s sleeping until past cycle %d\n", unit->name, clock);
+	unit->wake_clock = clock;
+	llsim_fall_asleep(unit);
+}
+
+void llsim_sleep_on_registers(llsim_unit_t *unit, llsim_unit_registers_t *ur, void *p, int size)
+{
+	char *base;
+
+	// p may point into either copy, they swap on tracked commits
+	base = (char *) p >= (char *) ur->old && (char *) p < (char *) ur->old + ur->size ? ur->old : ur->new;
+	unit->wake_regs = ur;
+	unit->wake_offset = (char *) p - base;
+	unit->wake_size = size;
+	llsim_assert(unit->wake_offset >= 0 && unit->wake_offset + size <= ur->size,
+		     "ERROR: unit %s watching outside registers %s\n", unit->name, ur->name);
+	llsim_fall_asleep(unit);
+}
+
+void llsim_sleep_on_memory(llsim_unit_t *unit, llsim_memory_t *mem)
+{
+	unit->wake_mem = mem;
+	llsim_fall_asleep(unit);
+}
+
+void llsim_wake(llsim_unit_t *unit)
+{
+	if (!unit->asleep)
+		return;
+	unit->asleep = 0;
+	unit->wake_clock = INT_MAX;
+	unit->wake_regs = NULL;
+	unit->wake_mem = NULL;
+	__atomic_fetch_sub(&unit->sim->nr_asleep, 1, __ATOMIC_RELAXED);
+}
+
+// wake units whose cycle has come, before any unit runs
+static void llsim_wake_timed(llsim_t *sim)
+{
+	int i;
+
+	for (i = 0; i < sim->nr_units; i++)
+		if (sim->sched_units[i].unit->wake_clock <= sim->clock)
+			llsim_wake(sim->sched_units[i].unit);
+}
+
+// wake units whose register range or memory changed, before commit
+static void llsim_wake_events(llsim_t *sim)
+{
+	llsim_unit_t *unit;
+	int i;
+
+	for (i = 0; i < sim->nr_units; i++) {
+		unit = sim->sched_units[i].unit;
+		if (!unit->asleep)
+			continue;
+		if ((unit->wake_mem && unit->wake_mem->last_write_clock == sim->clock) ||
+		    (unit->wake_regs && memcmp((char *) unit->wake_regs->old + unit->wake_offset,
+					       (char *) unit->wake_regs->new + unit->wake_offset, unit->wake_size)))
+			llsim_wake(unit);
+	}
+}
+
+void llsim_fast_forward(llsim_t *sim)
+{
+	llsim_memory_t *mem;
+	int i, j, clock, edge;
+
+	if (sim->nr_asleep < sim->nr_units)
+		return;
+	clock = INT_MAX;
+	for (i = 0; i < sim->nr_units; i++)
+		if (sim->sched_units[i].unit->wake_clock < clock)
+			clock = sim->sched_units[i].unit->wake_clock;
+	// outstanding memory requests resolve in their own cycle
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		for (j = 0; (mem->queued || mem->bursting) && j < mem->nr_ports; j++) {
+			if (mem->port[j].qcount && mem->port[j].queue[mem->port[j].qhead].due < clock)
+				clock = mem->port[j].queue[mem->port[j].qhead].due;
+			if (mem->port[j].burst && mem->port[j].burst_due < clock)
+				clock = mem->port[j].burst_due;
+		}
+		// and requests latched by a slower memory on its next edge
+		edge = sim->clock + (mem->phase - sim->clock % mem->period + mem->period) % mem->period;
+		for (j = 0; mem->period > 1 && j < mem->nr_ports; j++)
+			if ((mem->port[j].read || mem->port[j].write) && edge < clock)
+				clock = edge;
+	}
+	llsim_assert(clock != INT_MAX, "ERROR: all units asleep with no wake cycle\n");
+	if (clock <= sim->clock)
+		return;
+
+	// the skipped cycles are idle: registers hold, and dataout is poisoned
+	// by a memory with an edge among them. one with a latched request has
+	// none, the skip stops at its edge
+	for (i = 0; i < sim->nr_mems; i++) {
+		mem = sim->sched_mems[i];
+		edge = sim->clock + (mem->phase - sim->clock % mem->period + mem->period) % mem->period;
+		if (edge < clock)
+			llsim_resolve_memory(mem);
+	}
+	sim->clock = clock;
+}
+
+void llsim_run_clock(llsim_t *sim)
+{
+	llsim_sched_unit_t *su, *su_end;
+	llsim_memory_t **mem, **mem_end;
+	int i;
+
+	llsim_current = sim;
+	if (sim->nr_asleep)
+		llsim_wake_timed(sim);
+	if (sim->multiclock)
+		llsim_mark_edges(sim);
+
+	/*
+	 * settle wires, each driver once, in level order
+	 */
+	for (i = 0; i < sim->nr_combs; i++)
+		sim->sched_combs[i]->eval(sim->sched_combs[i]->unit);
+
+	/*
+	 * run units, each followed by its memories
+	 */
+	if (sim->nr_units == 1) {
+		su = sim->sched_units;
+		if (!su->unit->asleep && su->edge)
+			su->run(su->unit);
+		mem_end = sim->sched_mems + sim->nr_mems;
+		for (mem = sim->sched_mems; mem < mem_end; mem++)
+			if ((*mem)->edge)
+				llsim_resolve_memory(*mem);
+	} else if (sim->pool.threads) {
+		sim->pool.next = 0;
+		pthread_barrier_wait(&sim->pool.start);
+		llsim_pool_run_units(sim);
+		pthread_barrier_wait(&sim->pool.done);
+		mem_end = sim->sched_mems + sim->nr_mems;
+		for (mem = sim->sched_mems; mem < mem_end; mem++)
+			if ((*mem)->edge)
+				llsim_resolve_memory(*mem);
+	} else {
+		su_end = sim->sched_units + sim->nr_units;
+		for (su = sim->sched_units; su < su_end; su++) {
+			if (!su->unit->asleep && su->edge)
+				su->run(su->unit);
+			mem_end = sim->sched_mems + su->mem_first + su->mem_count;
+			for (mem = sim->sched_mems + su->mem_first; mem < mem_end; mem++)
+				if ((*mem)->edge)
+					llsim_resolve_memory(*mem);
+		}
+	}
+
+	if (sim->nr_asleep)
+		llsim_wake_events(sim);
+
+	/*
+	 * commit registers, in a multi clock model only those of units with
+	 * an edge on this tick
+	 */
+	if (!sim->multiclock) {
+		for (i = 0; i < sim->nr_regs; i++)
+			llsim_commit_registers(sim->sched_regs[i]);
+	} else {
+		su_end = sim->sched_units + sim->nr_units;
+		for (su = sim->sched_units; su < su_end; su++)
+			if (su->edge)
+				for (i = su->reg_first; i < su->reg_first + su->reg_count; i++)
+					llsim_commit_registers(sim->sched_regs[i]);
+	}
+
+	if (sim->hashlog.fp)
+		llsim_hashlog_clock(sim);
+}
+
+/*
+ * a simulation is self contained: everything it allocates comes from its
+ * own arena and every call names it, so independent simulations may run
+ * on different threads at once
+ */
+llsim_t *llsim_create(void)
+{
+	llsim_arena_t arena;
+	llsim_t *sim;
+
+	// the simulation structure is the first allocation of its own arena
+	memset(&arena, 0, sizeof(arena));
+	sim = (llsim_t *) llsim_arena_alloc(&arena, sizeof(llsim_t));
+	sim->arena = arena;
+	sim->output_prefix = "";
+	return sim;
+}
+
+void llsim_init(llsim_t *sim, char *program_name)
+{
+	llsim_current = sim;
+	sp_init(sim);
+	llsim_finalize(sim);
+	if (program_name)
+		llsim_load(sim, program_name);
+}
+
+void llsim_load(llsim_t *sim, char *program_name)
+{
+	llsim_unit_t *unit;
+
+	for (unit = sim->units; unit; unit = unit->next)
+		if (unit->load)
+			unit->load(unit, program_name);
+	// what llsim_reset_run goes back to
+	if (sim->pristine)
+		llsim_snapshot_free(sim->pristine);
+	sim->pristine = llsim_snapshot(sim);
+}
+
+// trace and dump files of the model land at prefix + name
+void llsim_set_output_prefix(llsim_t *sim, char *prefix)
+{
+	sim->output_prefix = llsim_malloc(sim, strlen(prefix) + 1);
+	strcpy(sim->output_prefix, prefix);
+}
+
+FILE *llsim_fopen(llsim_t *sim, char *name, char *mode)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s%s", sim->output_prefix, name);
+	return fopen(path, mode);
+}
+
+// a failed assertion still leaves the memory log of its simulation behind
+void llsim_abort(void)
+{
+	if (llsim_current) {
+		llsim_memlog_close(llsim_current);
+		llsim_hashlog_close(llsim_current);
+	}
+	exit(1);
+}
+
+/*
+ * tear the simulation down: units release what they hold outside the
+ * arena, then every chunk goes in one go
+ */
+void llsim_destroy(llsim_t *sim)
+{
+	llsim_arena_chunk_t *chunk, *next;
+	llsim_unit_t *unit;
+	llsim_memory_t *mem;
+
+	llsim_parallel_stop(sim);
+	llsim_memlog_close(sim);
+	llsim_hashlog_close(sim);
+	for (unit = sim->units; unit; unit = unit->next)
+		if (unit->destroy)
+			unit->destroy(unit);
+	while (sim->snapshots)
+		llsim_snapshot_free(sim->snapshots);
+	for (unit = sim->units; unit; unit = unit->next)
+		for (mem = unit->mems; mem; mem = mem->next)
+			if (mem->area)
+				llsim_mem_unmap(mem);
+	if (llsim_current == sim)
+		llsim_current = NULL;
+	for (chunk = sim->arena.chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+static void llsim_init_reset_values(llsim_t *sim)
+{
+	llsim_unit_t *unit;
+	llsim_unit_registers_t *ur;
+	llsim_register_t *reg;
+
+	/*
+	 * run units
+	 */
+	unit = sim->units;
+	while (unit) {
+		reg = unit->registers;
+		while (reg) {
+			* (int *) llsim_reg_new(reg) = reg->reset_value;
+			reg = reg->next;
+		}
+		for (ur = unit->regs; ur; ur = ur->next)
+			if (ur->dirty)
+				llsim_reg_track_all(ur);
+		unit = unit->next;
+	}
+}
+
+/*
+ * model parameters
+ */
+void llsim_set_param(llsim_t *sim, char *name, int value)
+{
+	llsim_param_t *param;
+
+	for (param = sim->params; param; param = param->next)
+		if (strcmp(param->name, name) == 0)
+			break;
+	if (!param) {
+		param = (llsim_param_t *) llsim_malloc(sim, sizeof(llsim_param_t));
+		param->name = llsim_malloc(sim, strlen(name) + 1);
+		strcpy(param->name, name);
+		param->next = sim->params;
+		sim->params = param;
+	}
+	param->value = value;
+}
+
+int llsim_param(llsim_t *sim, char *name, int default_value)
+{
+	llsim_param_t *param;
+
+	for (param = sim->params; param; param = param->next)
+		if (strcmp(param->name, name) == 0)
+			return param->value;
+	return default_value;
+}
+
+void llsim_stop(llsim_t *sim)
+{
+	llsim_halt(sim, LLSIM_STOP_MODEL);
+}
+
+/*
+ * observers
+ */
+void llsim_observe(llsim_t *sim, int type, void (*fn) (llsim_event_t *event, void *arg), void *arg)
+{
+	llsim_observer_t *observer, **tail;
+
+	llsim_assert(type >= 0 && type < LLSIM_NR_EVENTS, "ERROR: unknown event type %d\n", type);
+	observer = (llsim_observer_t *) llsim_malloc(sim, sizeof(llsim_observer_t));
+	observer->fn = fn;
+	observer->arg = arg;
+	for (tail = &sim->observers[type]; *tail; tail = &(*tail)->next)
+		;
+	*tail = observer;
+}
+
+void llsim_notify(llsim_t *sim, llsim_event_t *event)
+{
+	llsim_observer_t *observer;
+
+	for (observer = sim->observers[event->type]; observer; observer = observer->next)
+		observer->fn(event, observer->arg);
+}
+
+/*
+ * run control
+ */
+static char *llsim_cond_ops[] = {"==", "!=", "<", "<=", ">", ">="};
+
+static void llsim_runctl_retire(llsim_event_t *event, void *arg)
+{
+	llsim_t *sim = (llsim_t *) arg;
+	llsim_runctl_t *rc = &sim->runctl;
+	llsim_cond_t *cond;
+	int i, v, hit;
+
+	rc->insts++;
+	if (rc->max_insts && rc->insts >= rc->max_insts) {
+		llsim_printf("llsim: clock %d: instruction budget of %d exhausted\n", sim->clock, rc->max_insts);
+		llsim_halt(sim, LLSIM_STOP_INSTS);
+	}
+	if ((unsigned int) event->pc < (unsigned int) rc->nr_break_words * 32 &&
+	    (rc->breaks[event->pc >> 5] & (1u << (event->pc & 31)))) {
+		llsim_printf("llsim: clock %d: breakpoint at pc %d\n", sim->clock, event->pc);
+		llsim_halt(sim, LLSIM_STOP_BREAK);
+	}
+	for (i = 0; i < rc->nr_conds; i++) {
+		cond = &rc->conds[i];
+		v = *(int *) ((char *) *cond->base + cond->offset);
+		switch (cond->op) {
+		case LLSIM_COND_EQ: hit = v == cond->value; break;
+		case LLSIM_COND_NE: hit = v != cond->value; break;
+		case LLSIM_COND_LT: hit = v < cond->value; break;
+		case LLSIM_COND_LE: hit = v <= cond->value; break;
+		case LLSIM_COND_GT: hit = v > cond->value; break;
+		default: hit = v >= cond->value; break;
+		}
+		if (hit) {
+			llsim_printf("llsim: clock %d: condition %s.%s %s %d met\n", sim->clock,
+				     cond->unit_name, cond->reg_name, llsim_cond_ops[cond->op], cond->value);
+			llsim_halt(sim, LLSIM_STOP_COND);
+		}
+	}
+}
+
+static void llsim_runctl_observe(llsim_t *sim)
+{
+	if (sim->runctl.retire_observed)
+		return;
+	sim->runctl.retire_observed = 1;
+	llsim_observe(sim, LLSIM_EVENT_RETIRE, llsim_runctl_retire, sim);
+}
+
+void llsim_break(llsim_t *sim, int pc)
+{
+	llsim_runctl_t *rc = &sim->runctl;
+	unsigned int *breaks;
+	int n;
+
+	llsim_assert(pc >= 0, "ERROR: breakpoint at pc %d\n", pc);
+	if (pc >= rc->nr_break_words * 32) {
+		n = (pc >> 5) + 1;
+		breaks = (unsigned int *) llsim_malloc(sim, n * sizeof(unsigned int));
+		if (rc->nr_break_words)
+			memcpy(breaks, rc->breaks, rc->nr_break_words * sizeof(unsigned int));
+		rc->breaks = breaks;
+		rc->nr_break_words = n;
+	}
+	rc->breaks[pc >> 5] |= 1u << (pc & 31);
+	llsim_runctl_observe(sim);
+}
+
+static void llsim_watch_apply(llsim_t *sim, llsim_cond_t *req)
+{
+	llsim_memory_t *mem;
+	int i;
+
+	for (i = 0; i < sim->nr_mems; i++)
+		if (strcmp(sim->sched_mems[i]->name, req->mem_name) == 0)
+			break;
+	llsim_assert(i < sim->nr_mems, "ERROR: no memory %s to watch\n", req->mem_name);
+	mem = sim->sched_mems[i];
+	llsim_assert(req->mem_addr >= 0 && req->mem_n > 0 && req->mem_addr + req->mem_n <= mem->height,
+		     "ERROR: watchpoint %d+%d outside memory %s\n", req->mem_addr, req->mem_n, mem->name);
+	if (!mem->watch)
+		mem->watch = (unsigned int *) llsim_malloc(sim, ((mem->height + 31) >> 5) * sizeof(unsigned int));
+	for (i = req->mem_addr; i < req->mem_addr + req->mem_n; i++)
+		mem->watch[i >> 5] |= 1u << (i & 31);
+}
+
+static void llsim_cond_apply(llsim_t *sim, llsim_cond_t *req)
+{
+	llsim_runctl_t *rc = &sim->runctl;
+	llsim_unit_t *unit;
+	llsim_register_t *reg;
+	llsim_cond_t *conds;
+
+	unit = llsim_find_unit(sim, req->unit_name);
+	llsim_assert(unit != NULL, "ERROR: couldn't find unit %s", req->unit_name);
+	reg = llsim_find_register(unit, req->reg_name);
+	llsim_assert(reg != NULL, "ERROR: couldn't find register %s.%s\n", req->unit_name, req->reg_name);
+
+	// the compiled conditions stay one array
+	conds = (llsim_cond_t *) llsim_malloc(sim, (rc->nr_conds + 1) * sizeof(llsim_cond_t));
+	if (rc->nr_conds)
+		memcpy(conds, rc->conds, rc->nr_conds * sizeof(llsim_cond_t));
+	conds[rc->nr_conds] = *req;
+	conds[rc->nr_conds].base = reg->oldbase;
+	conds[rc->nr_conds].offset = reg->offset;
+	conds[rc->nr_conds].next = NULL;
+	rc->conds = conds;
+	rc->nr_conds++;
+	llsim_runctl_observe(sim);
+}
+
+static void llsim_runctl_apply(llsim_t *sim)
+{
+	llsim_cond_t *req;
+
+	for (req = sim->runctl.pending; req; req = req->next) {
+		if (req->mem_name)
+			llsim_watch_apply(sim, req);
+		else
+			llsim_cond_apply(sim, req);
+	}
+	sim->runctl.pending = NULL;
+}
+
+// requests that name parts of the model wait for it to be built
+static void llsim_runctl_request(llsim_t *sim, llsim_cond_t *req)
+{
+	llsim_cond_t **tail;
+
+	if (sim->finalized) {
+		if (req->mem_name)
+			llsim_watch_apply(sim, req);
+		else
+			llsim_cond_apply(sim, req);
+		return;
+	}
+	for (tail = &sim->runctl.pending; *tail; tail = &(*tail)->next)
+		;
+	*tail = req;
+}
+
+void llsim_watch(llsim_t *sim, char *mem_name, int addr, int n)
+{
+	llsim_cond_t *req;
+
+	req = (llsim_cond_t *) llsim_malloc(sim, sizeof(llsim_cond_t));
+	req->mem_name = llsim_intern(sim, mem_name);
+	req->mem_addr = addr;
+	req->mem_n = n;
+	llsim_runctl_request(sim, req);
+}
+
+void llsim_break_if(llsim_t *sim, char *unit_name, char *reg_name, int op, int value)
+{
+	llsim_cond_t *req;
+
+	llsim_assert(op >= LLSIM_COND_EQ && op <= LLSIM_COND_GE, "ERROR: unknown condition %d\n", op);
+	req = (llsim_cond_t *) llsim_malloc(sim, sizeof(llsim_cond_t));
+	req->unit_name = llsim_intern(sim, unit_name);
+	req->reg_name = llsim_intern(sim, reg_name);
+	req->op = op;
+	req->value = value;
+	llsim_runctl_request(sim, req);
+}
+
+// 0 lifts a budget
+void llsim_set_budget(llsim_t *sim, int max_clocks, int max_insts)
+{
+	sim->runctl.max_clocks = max_clocks;
+	sim->runctl.max_insts = max_insts;
+	if (max_insts)
+		llsim_runctl_observe(sim);
+}
+
+/*
+ * one run control request in command line form: break=pc,
+ * watch=mem:addr[+n], cond=unit.reg<op>value with a C comparison
+ * operator, clocks=n or insts=n
+ */
+int llsim_run_control(llsim_t *sim, char *spec)
+{
+	char *value, *sep, *end, *unit_name;
+	int addr, n, op;
+
+	// cut up a copy, the arguments may be passed on to a server
+	spec = strcpy(llsim_malloc(sim, strlen(spec) + 1), spec);
+	value = strchr(spec, '=');
+	if (!value)
+		return 1;
+	*value++ = 0;
+	if (strcmp(spec, "break") == 0) {
+		llsim_break(sim, strtol(value, &end, 0));
+		return *end != 0;
+	}
+	if (strcmp(spec, "clocks") == 0) {
+		llsim_set_budget(sim, strtol(value, &end, 0), sim->runctl.max_insts);
+		return *end != 0;
+	}
+	if (strcmp(spec, "insts") == 0) {
+		llsim_set_budget(sim, sim->runctl.max_clocks, strtol(value, &end, 0));
+		return *end != 0;
+	}
+	if (strcmp(spec, "watch") == 0) {
+		sep = strchr(value, ':');
+		if (!sep)
+			return 1;
+		*sep++ = 0;
+		addr = strtol(sep, &end, 0);
+		n = *end == '+' ? strtol(end + 1, &end, 0) : 1;
+		if (*end)
+			return 1;
+		llsim_watch(sim, value, addr, n);
+		return 0;
+	}
+	if (strcmp(spec, "cond") == 0) {
+		unit_name = value;
+		sep = strchr(value, '.');
+		value = strpbrk(value, "=!<>");
+		if (!sep || !value || value < sep)
+			return 1;
+		*sep++ = 0;
+		// longest operator first, <= before <
+		for (op = LLSIM_COND_GE; op >= LLSIM_COND_EQ; op--)
+			if (strncmp(value, llsim_cond_ops[op], strlen(llsim_cond_ops[op])) == 0)
+				break;
+		if (op < LLSIM_COND_EQ)
+			return 1;
+		n = strtol(value + strlen(llsim_cond_ops[op]), &end, 0);
+		if (*end)
+			return 1;
+		*value = 0;
+		llsim_break_if(sim, unit_name, sep, op, n);
+		return 0;
+	}
+	return 1;
+}
+
+void llsim_resume(llsim_t *sim)
+{
+	int from;
+
+	llsim_runctl_apply(sim);
+	sim->stop = 0;
+	while (!sim->stop) {
+		from = sim->clock;
+		llsim_fast_forward(sim);
+		if (sim->runctl.max_clocks && sim->clock >= sim->runctl.max_clocks) {
+			llsim_printf("llsim: clock %d: clock budget of %d exhausted\n", sim->clock, sim->runctl.max_clocks);
+			llsim_halt(sim, LLSIM_STOP_CLOCKS);
+			break;
+		}
+		printf(">>>>> clock %d <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n", sim->clock);
+		llsim_run_clock(sim);
+		sim->clock++;
+		// fast forwarding may skip over a multiple of the period, and a finished model has nothing to resume
+		if (sim->checkpoint_period && sim->clock / sim->checkpoint_period != from / sim->checkpoint_period &&
+		    sim->stop != LLSIM_STOP_MODEL)
+			llsim_checkpoint_save(sim, sim->checkpoint_file);
+		/*
+		if ((sim->clock % 1000000) == 0)
+			printf("clock %d\n", sim->clock);
+		*/
+	}
+}
+
+void llsim_reset(llsim_t *sim)
+{
+	int i;
+
+	llsim_printf("llsim: starting simulation\n");
+	sim->reset = 1;
+
+	// init registers
+	llsim_init_reset_values(sim);
+
+	for (i = 0; i < 5; i++) {
+		llsim_run_clock(sim);
+		sim->clock++;
+	}
+	sim->reset = 0;
+}
+
+void llsim_run(llsim_t *sim)
+{
+	llsim_reset(sim);
+	llsim_resume(sim);
+}
+
+static void llsim_mem_idle(llsim_memory_t *mem)
+{
+	llsim_mem_port_t *p;
+	int i, j;
+
+	for (i = 0; i < mem->nr_ports; i++) {
+		p = &mem->port[i];
+		p->read = p->read_addr = p->write = p->write_addr = 0;
+		memset(p->datain, 0, mem->entry_size * sizeof(int));
+		memset(p->dataout, 0, mem->entry_size * sizeof(int));
+		p->ready = 1;
+		p->valid = 0;
+		for (j = 0; p->queue && j < p->depth; j++) {
+			p->queue[j].due = p->queue[j].write = p->queue[j].addr = 0;
+			memset(p->queue[j].data, 0, mem->entry_size * sizeof(int));
+		}
+		p->qhead = p->qcount = p->qlast_due = 0;
+		p->burst = p->burst_write = p->burst_addr = p->burst_n = p->burst_due = 0;
+		p->burst_buf = NULL;
+	}
+	mem->bursting = 0;
+	mem->last_write_clock = -1;
+}
+
+void llsim_reset_run(llsim_t *sim)
+{
+	llsim_unit_registers_t *ur;
+	llsim_unit_t *unit;
+	int i;
+
+	llsim_assert(sim->pristine, "ERROR: llsim_reset_run before a program was loaded\n");
+	llsim_snapshot_restore(sim->pristine);
+	for (i = 0; i < sim->nr_mems; i++)
+		llsim_mem_idle(sim->sched_mems[i]);
+	for (i = 0; i < sim->nr_regs; i++) {
+		ur = sim->sched_regs[i];
+		memset(ur->old, 0, ur->size);
+		memset(ur->new, 0, ur->size);
+		if (ur->dirty)
+			llsim_reg_track_all(ur);
+	}
+	for (i = 0; i < sim->nr_units; i++) {
+		unit = sim->sched_units[i].unit;
+		llsim_wake(unit);
+		if (unit->reset_run)
+			unit->reset_run(unit);
+	}
+	sim->clock = 0;
+	sim->reset = 0;
+	sim->stop = 0;
+	sim->runctl.insts = 0;
+}
+
+/*
+ * simulation server
+ */
+static int llsim_write_all(int fd, const void *p, int len)
+{
+	int n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n <= 0)
+			return 1;
+		p = (const char *) p + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int llsim_read_all(int fd, void *p, int len)
+{
+	int n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n <= 0)
+			return 1;
+		p = (char *) p + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int llsim_socket(char *socket_name, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(socket_name) >= sizeof(addr->sun_path)) {
+		printf("socket name %s too long\n", socket_name);
+		return -1;
+	}
+	strcpy(addr->sun_path, socket_name);
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+// a job, in a process of its own forked from the server
+static int llsim_serve_job(llsim_t *sim, int conn, int (*job) (llsim_t *sim, int argc, char **argv))
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char *req, **argv;
+	int len, fds[2], argc, i;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	if (recvmsg(conn, &msg, MSG_WAITALL) != sizeof(len) || len <= 0 || len > LLSIM_SERVER_MAX_REQUEST)
+		return 1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+		return 1;
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	req = (char *) malloc(len + 1);
+	argv = (char **) malloc((len / 2 + 2) * sizeof(char *));
+	if (req == NULL || argv == NULL || llsim_read_all(conn, req, len))
+		return 1;
+	req[len] = 0;
+	close(conn);
+
+	dup2(fds[0], 1);
+	dup2(fds[1], 2);
+	close(fds[0]);
+	close(fds[1]);
+	setvbuf(stdout, NULL, isatty(1) ? _IOLBF : _IOFBF, BUFSIZ);
+	if (chdir(req)) {
+		printf("couldn't change to directory %s\n", req);
+		return 1;
+	}
+	argc = 0;
+	for (i = strlen(req) + 1; i < len; i += strlen(req + i) + 1)
+		argv[argc++] = req + i;
+	argv[argc] = NULL;
+	return job(sim, argc, argv);
+}
+
+static void llsim_serve_sigchld(int sig)
+{
+}
+
+/*
+ * the server keeps the connection of each running job and answers it
+ * with the job's exit status once the job is reaped. SIGCHLD is only let
+ * in while waiting for a connection, so no exit goes unnoticed.
+ */
+int llsim_serve(llsim_t *sim, char *socket_name, int (*job) (llsim_t *sim, int argc, char **argv))
+{
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	fd_set fds;
+	sigset_t block, orig;
+	pid_t pid, *pids = NULL;
+	int *conns = NULL;
+	int sock, conn, status, i, nr_jobs = 0, max_jobs = 0;
+
+	llsim_init(sim, NULL);
+	llsim_assert(!sim->pool.threads, "ERROR: a parallel simulation can't be forked\n");
+	llsim_reset(sim);
+
+	sock = llsim_socket(socket_name, &addr);
+	unlink(socket_name);
+	if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) || listen(sock, 64)) {
+		printf("couldn't listen on %s\n", socket_name);
+		return 1;
+	}
+	sigemptyset(&block);
+	sigaddset(&block, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &block, &orig);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = llsim_serve_sigchld;
+	sigaction(SIGCHLD, &sa, NULL);
+	llsim_printf("llsim: serving on %s\n", socket_name);
+	fflush(stdout);
+
+	for (;;) {
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (i = 0; i < nr_jobs && pids[i] != pid; i++)
+				;
+			if (i == nr_jobs)
+				continue;
+			status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+			llsim_write_all(conns[i], &status, sizeof(status));
+			close(conns[i]);
+			nr_jobs--;
+			pids[i] = pids[nr_jobs];
+			conns[i] = conns[nr_jobs];
+		}
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		if (pselect(sock + 1, &fds, NULL, NULL, NULL, &orig) <= 0)
+			continue;
+		conn = accept(sock, NULL, NULL);
+		if (conn < 0)
+			continue;
+		if (nr_jobs == max_jobs) {
+			max_jobs = max_jobs ? 2 * max_jobs : 64;
+			pids = (pid_t *) realloc(pids, max_jobs * sizeof(pid_t));
+			conns = (int *) realloc(conns, max_jobs * sizeof(int));
+			llsim_assert(pids != NULL && conns != NULL, "out of memory");
+		}
+		pid = fork();
+		if (pid == 0) {
+			sigprocmask(SIG_SETMASK, &orig, NULL);
+			signal(SIGCHLD, SIG_DFL);
+			close(sock);
+			for (i = 0; i < nr_jobs; i++)
+				close(conns[i]);
+			exit(llsim_serve_job(sim, conn, job));
+		}
+		if (pid < 0) {
+			close(conn);
+			continue;
+		}
+		pids[nr_jobs] = pid;
+		conns[nr_jobs++] = conn;
+	}
+}
+
+// run a job on the server, with this process's working directory, stdout and stderr
+int llsim_submit(char *socket_name, int argc, char **argv)
+{
+	char cbuf[CMSG_SPACE(2 * sizeof(int))];
+	char req[LLSIM_SERVER_MAX_REQUEST];
+	int fds[2] = {1, 2};
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int sock, len, n, i, status;
+
+	if (getcwd(req, sizeof(req)) == NULL)
+		return 1;
+	len = strlen(req) + 1;
+	for (i = 0; i < argc; i++) {
+		n = strlen(argv[i]) + 1;
+		if (len + n > sizeof(req)) {
+			printf("request too long\n");
+			return 1;
+		}
+		memcpy(req + len, argv[i], n);
+		len += n;
+	}
+
+	sock = llsim_socket(socket_name, &addr);
+	if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr))) {
+		printf("couldn't connect to %s\n", socket_name);
+		return 1;
+	}
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	fflush(NULL);
+	if (sendmsg(sock, &msg, 0) != sizeof(len) || llsim_write_all(sock, req, len) || llsim_read_all(sock, &status, sizeof(status))) {
+		printf("lost the connection to %s\n", socket_name);
+		return 1;
+	}
+	close(sock);
+	return status;
+}
+
+/*
+ * command line. programs that drive llsim themselves, like bench_mem
+ * and test_snapshot, build with -DLLSIM_NO_MAIN and leave it out.
+ */
+#ifndef LLSIM_NO_MAIN
+static void llsim_usage(char *prog)
+{
+	printf("usage: %s [-l off|ring|file|text] [-o mem_log_file] [-H hash_log_file] [-r run_control] [-j threads] [-p name=value]\n"
+	       "       [-c clocks:checkpoint_file] [-R checkpoint_file] [-C socket] program\n", prog);
+	printf("       %s [-j threads] [-p name=value] -S socket\n", prog);
+	printf("       %s -d mem_log_file\n", prog);
+	printf("       %s -b hash_log_file hash_log_file\n", prog);
+	exit(1);
+}
+
+/*
+ * a run from the command line, or a job of the server on its warm model,
+ * which fixes the model's parameters. -S serves jobs, -C hands this one
+ * to a server.
+ */
+static int llsim_job(llsim_t *sim, int argc, char **argv)
+{
+	char *memlog_file = "mem_log.bin";
+	char *hashlog_file = NULL, *bisect_file = NULL, *restore_file = NULL;
+	char *server_socket = NULL, *client_socket = NULL;
+	int memlog_level = LLSIM_MEMLOG_OFF;
+	int warm = sim->finalized;
+	char *value;
+	int opt;
+
+	optind = 1;
+	while ((opt = getopt(argc, argv, "l:o:d:H:b:r:j:p:c:R:S:C:")) != -1) {
+		if (warm && (opt == 'j' || opt == 'p' || opt == 'S')) {
+			printf("llsim: -%c is fixed by the server\n", opt);
+			return 1;
+		}
+		switch (opt) {
+		case 'l':
+			if (strcmp(optarg, "off") == 0)
+				memlog_level = LLSIM_MEMLOG_OFF;
+			else if (strcmp(optarg, "ring") == 0)
+				memlog_level = LLSIM_MEMLOG_RING;
+			else if (strcmp(optarg, "file") == 0)
+				memlog_level = LLSIM_MEMLOG_FILE;
+			else if (strcmp(optarg, "text") == 0)
+				memlog_level = LLSIM_MEMLOG_TEXT;
+			else
+				llsim_usage(argv[0]);
+			break;
+		case 'o':
+			memlog_file = optarg;
+			break;
+		case 'd':
+			return llsim_memlog_decode(optarg, stdout);
+		case 'H':
+			hashlog_file = optarg;
+			break;
+		case 'b':
+			bisect_file = optarg;
+			break;
+		case 'r':
+			if (llsim_run_control(sim, optarg))
+				llsim_usage(argv[0]);
+			break;
+		case 'j':
+			llsim_parallel(sim, atoi(optarg));
+			break;
+		case 'p':
+			value = strchr(optarg, '=');
+			if (!value)
+				llsim_usage(argv[0]);
+			*value = 0;
+			llsim_set_param(sim, optarg, strtol(value + 1, NULL, 0));
+			*value = '=';
+			break;
+		case 'c':
+			value = strchr(optarg, ':');
+			if (!value || atoi(optarg) <= 0)
+				llsim_usage(argv[0]);
+			llsim_checkpoint_every(sim, atoi(optarg), value + 1);
+			break;
+		case 'R':
+			restore_file = optarg;
+			break;
+		case 'S':
+			server_socket = optarg;
+			break;
+		case 'C':
+			client_socket = optarg;
+			break;
+		default:
+			llsim_usage(argv[0]);
+		}
+	}
+	if (server_socket) {
+		if (optind != argc)
+			llsim_usage(argv[0]);
+		return llsim_serve(sim, server_socket, llsim_job);
+	}
+	if (optind != argc - 1)
+		llsim_usage(argv[0]);
+	if (bisect_file)
+		return llsim_hashlog_bisect(bisect_file, argv[optind], stdout);
+	if (client_socket && !warm)
+		return llsim_submit(client_socket, argc, argv);
+
+	llsim_memlog_open(sim, memlog_level, memlog_file);
+	if (hashlog_file)
+		llsim_hashlog_open(sim, hashlog_file);
+	if (warm)
+		llsim_load(sim, argv[optind]);
+	else
+		llsim_init(sim, argv[optind]);
+	if (restore_file) {
+		llsim_checkpoint_restore(sim, restore_file);
+		llsim_resume(sim);
+	} else if (warm) {
+		llsim_resume(sim);
+	} else {
+		llsim_run(sim);
+	}
+	llsim_destroy(sim);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	return llsim_job(llsim_create(), argc, argv);
+}
+#endif
@@ -1,18 +1,29 @@
 #ifndef _LLSIM_H_
 #define _LLSIM_H_
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 typedef long long i64;
+typedef unsigned long long u64;
 
-void sp_init(char *program_name);
+struct llsim_s;
+void sp_init(struct llsim_s *sim);
 
 /*
- * support functions
+ * support functions. assertions report the clock of the simulation the
+ * calling thread is running, llsim_current, and flush its memory log on
+ * the way out; nothing else looks at it.
  */
+extern __thread struct llsim_s *llsim_current;
+void llsim_abort(void) __attribute__((noreturn));
+
 #define llsim_assert(cond, args...)					\
 	do {								\
 		if (!(cond)) {						\
-			printf("llsim: clock %d: assertion failed at file %s line %d: ", llsim->clock, __FILE__, __LINE__); \
+			printf("llsim: clock %d: assertion failed at file %s line %d: ", llsim_current ? llsim_current->clock : -1, __FILE__, __LINE__); \
 			printf(args);					\
-			exit (1);					\
+			llsim_abort();					\
 		}							\
 	} while (0);							\
 
@@ -20,12 +31,13 @@ void sp_init(char *program_name);
 
 #define llsim_error(args...) llsim_assert(0, args)
 
+/*
+ * bit field helpers. masks are computed without branches, so with
+ * constant msb/lsb every helper folds down to a shift and a mask.
+ */
 static inline int bitmask0(int bits)
 {
-	if (bits == 32)
-		return -1;
-	else
-		return ((((int) 1) << bits) - 1);
+	return (int) ((1ULL << bits) - 1);
 }
 
 static inline int bitmask(int msb, int lsb)
@@ -35,10 +47,7 @@ static inline int bitmask(int msb, int lsb)
 
 static inline int sbs(int val, int msb, int lsb)
 {
-	if (msb == 31 && lsb == 0)
-		return val;
-	else
-		return ((val >> lsb) & bitmask0(msb - lsb + 1));
+	return (val >> lsb) & bitmask0(msb - lsb + 1);
 }
 
 static inline int sb(int val, int bit)
@@ -46,28 +55,21 @@ static inline int sb(int val, int bit)
 	return (val >> bit) & 1;
 }
 
+// sign extended val[msb:lsb]
 static inline int ssbs(int val, int msb, int lsb)
 {
-	int val2;
-
-	val2 = sbs(val, msb, lsb);
-	if (sb(val2,msb))
-		val2 -= (1 << (msb+1));
-	return val2;
+	return (int) ((unsigned int) val << (31 - msb)) >> (31 - msb + lsb);
 }
 
 static inline int rbs(int val, int data, int msb, int lsb)
 {
-	val = (val & (~bitmask(msb,lsb))) | ((data << lsb) & bitmask(msb,lsb));
+	val = (val & (~bitmask(msb,lsb))) | ((int) ((unsigned int) data << lsb) & bitmask(msb,lsb));
 	return val;
 }
 
 static inline i64 lbitmask0(int bits)
 {
-	if (bits == 64)
-		return -1;
-	else
-		return ((((i64) 1) << bits) - 1);
+	return (i64) (~0ULL >> (64 - bits));
 }
 
 static inline i64 lbitmask(int msb, int lsb)
@@ -77,15 +79,12 @@ static inline i64 lbitmask(int msb, int lsb)
 
 static inline i64 lsbs(i64 val, int msb, int lsb)
 {
-	if (msb == 63 && lsb == 0)
-		return val;
-	else
-		return ((val >> lsb) & lbitmask0(msb - lsb + 1));
+	return (val >> lsb) & lbitmask0(msb - lsb + 1);
 }
 
 static inline i64 lrbs(i64 val, int data, int msb, int lsb)
 {
-	val = (val & (~lbitmask(msb,lsb))) | ((data << lsb) & bitmask(msb,lsb));
+	val = (val & (~lbitmask(msb,lsb))) | ((i64) ((unsigned long long) (unsigned int) data << lsb) & lbitmask(msb,lsb));
 	return val;
 }
 
@@ -105,47 +104,207 @@ static inline int cb(int val, int pos)
 	return cbs(val,pos,pos);
 }
 
+/*
+ * fields of up to 32 bits in an array of 32 bit words, least significant
+ * word first. a field may straddle two words; nothing past its last word
+ * is touched. inlined with constant msb/lsb, the word index, offset and
+ * straddle test all resolve at compile time.
+ */
+static inline int llsim_field_extract(const int *p, int msb, int lsb)
+{
+	const unsigned int *w = (const unsigned int *) p + (lsb >> 5);
+	int off = lsb & 31, width = msb - lsb + 1;
+	unsigned int val;
+
+	val = w[0] >> off;
+	if (off + width > 32)
+		val |= w[1] << (32 - off);
+	return (int) (val & (unsigned int) bitmask0(width));
+}
+
+static inline void llsim_field_inject(int *p, int data, int msb, int lsb)
+{
+	unsigned int *w = (unsigned int *) p + (lsb >> 5);
+	int off = lsb & 31, width = msb - lsb + 1;
+	unsigned int mask, val;
+
+	mask = (unsigned int) bitmask0(width);
+	val = (unsigned int) data & mask;
+	w[0] = (w[0] & ~(mask << off)) | (val << off);
+	if (off + width > 32)
+		w[1] = (w[1] & ~(mask >> (32 - off))) | (val >> (32 - off));
+}
+
 /*
  * simulated unit registers
  */
 typedef struct llsim_unit_registers_s {
+	struct llsim_s *sim;
 	char *name;
 	int size;
 	void *old,*new;
+	unsigned long long *dirty;	// words of new written this cycle, NULL if untracked
+	int dirty_len;			// number of 64 bit words in dirty
 	struct llsim_unit_registers_s *next;
 } llsim_unit_registers_t;
 
 /*
- * memory
+ * register write tracking
+ *
+ * a tracked register block is committed by swapping old and new and
+ * copying forward only the words written during the cycle, instead of
+ * copying the whole block. units that opt in must report every write to
+ * new, and must reload their old/new pointers at the start of each cycle.
  */
-typedef struct llsim_memory_s {
-	int entry_size;
-	int bits;
-	int height;
-	int dp;
-	int *data;
-	char *name;
+static inline void llsim_reg_track(llsim_unit_registers_t *ur, void *p, int size)
+{
+	int word, last;
+
+	word = ((char *) p - (char *) ur->new) >> 2;
+	last = word + ((size + 3) >> 2);
+	for (; word < last; word++)
+		ur->dirty[word >> 6] |= 1ULL << (word & 63);
+}
+
+static inline void llsim_reg_track_all(llsim_unit_registers_t *ur)
+{
+	memset(ur->dirty, 0xff, ur->dirty_len * sizeof(unsigned long long));
+}
 
+/*
+ * memory. entries are entry_size 32 bit words, least significant word first.
+ *
+ * a memory has dp ports (0 is taken as 1), each able to do one read or
+ * one write per cycle. the collision mode decides what happens when
+ * ports touch the same address in a cycle.
+ *
+ * by default a read issued in cycle n has its dataout in cycle n+1 and a
+ * write lands at the end of cycle n. llsim_mem_set_latency stretches this
+ * per port: requests wait in a queue of up to depth outstanding entries
+ * and complete in order, at most one per cycle. a port only takes a
+ * request while ready, and dataout holds read data only while valid.
+ *
+ * a burst moves n consecutive entries between the memory and a caller
+ * buffer in one request, at the memory's bandwidth in words per cycle
+ * (one entry per cycle by default). it occupies the port until it lands;
+ * the buffer must be left alone until the port is ready again.
+ */
+#define LLSIM_MEM_MAX_BITS	512
+#define LLSIM_MEM_MAX_PORTS	4
+
+// contents are stored sparsely, a page is materialized on its first write
+#define LLSIM_MEM_PAGE_SHIFT	8
+#define LLSIM_MEM_PAGE_ENTRIES	(1 << LLSIM_MEM_PAGE_SHIFT)
+
+// page_dirty bits
+#define LLSIM_PAGE_HASH		1	// listed in dirty_pages for the state hash
+#define LLSIM_PAGE_SNAP		2	// listed in snap_dirty, changed since the last snapshot
+#define LLSIM_PAGE_LIVE		4	// materialized
+
+#define LLSIM_MEM_COLLISION_ERROR	0	// assert (default)
+#define LLSIM_MEM_COLLISION_READ_FIRST	1	// reads see the old entry, highest port write wins
+#define LLSIM_MEM_COLLISION_WRITE_FIRST	2	// reads see the entry written this cycle
+
+typedef struct llsim_mem_req_s {
+	int due;		// cycle at whose end the request resolves
+	int write;
+	int addr;
+	int *data;		// datain captured when a write was issued
+} llsim_mem_req_t;
+
+typedef struct llsim_mem_port_s {
 	int read;
 	int read_addr;
 	int write;
 	int write_addr;
 	int *datain;
 	int *dataout;
+	int ready;
+	int valid;
+
+	// outstanding requests, a ring of depth preallocated entries
+	int read_latency, write_latency, depth;
+	llsim_mem_req_t *queue;
+	int qhead, qcount, qlast_due;
+
+	// burst in flight, due is -1 until its issue cycle resolves
+	int burst;
+	int burst_write;
+	int burst_addr;
+	int burst_n;
+	int *burst_buf;
+	int burst_due;
+
+	// requesting units, only tracked in parallel mode
+	struct llsim_unit_s *read_unit, *write_unit;
+} llsim_mem_port_t;
+
+typedef struct llsim_memory_s {
+	struct llsim_s *sim;
+	int id;
+	int entry_size;
+	int bits;
+	int height;
+	int dp;
+	int nr_ports;
+	int collision;
+	int queued;		// some port has a latency above 1
+	int bandwidth;		// words per cycle moved by bursts
+	int bursting;		// bursts in flight
+	int period, phase;	// clock domain, period 0 follows the owning unit
+	int edge;		// resolves this tick
+	int last_write_clock;
+	int **pages;		// page table, untouched pages point at a shared zero page
+	int nr_pages;
+	char *page_dirty;	// LLSIM_PAGE_* bits
+	int page_track;		// bits a write finds set unless it has bookkeeping to do
+	int *dirty_pages;	// pages written since the state hash last looked
+	int nr_dirty;
+	int *snap_dirty;	// pages changed since snap_base
+	int nr_snap_dirty;
+	int **snap_base;	// snapshot pages the contents last matched, see llsim_snapshot
+	struct llsim_snap_page_s *snap_free;
+	char *area;		// all pages in one mapping, under llsim_snapshot_protect
+	size_t area_len;
+	u64 *page_hash;		// state hash of each page, allocated by the hash log
+	u64 hash;		// sum of the mixed page hashes
+	unsigned int *watch;	// one bit per entry with a write watchpoint, see llsim_watch
+	char *name;
+
+	llsim_mem_port_t port[LLSIM_MEM_MAX_PORTS];
 
 	struct llsim_memory_s *next;
 } llsim_memory_t;
 
+/*
+ * a named register. one inside a register block of its unit is reached
+ * through the block, whose copies swap on tracked commits.
+ */
+#define LLSIM_REG_TRACE		1	// printed by llsim_trace_registers
+
 typedef struct llsim_register_s {
 	char *unit_name;
 	char *reg_name;
 	int bits;
 	int reset_value;
+	int flags;
 	void *oldp;
 	void *newp;
+	void **oldbase, **newbase;
+	int offset;
 	struct llsim_register_s *next;
 } llsim_register_t;
 
+static inline void *llsim_reg_old(llsim_register_t *reg)
+{
+	return (char *) *reg->oldbase + reg->offset;
+}
+
+static inline void *llsim_reg_new(llsim_register_t *reg)
+{
+	return (char *) *reg->newbase + reg->offset;
+}
+
 typedef struct llsim_output_s {
 	char *unit_name;
 	char *output_name;
@@ -155,62 +314,700 @@ typedef struct llsim_output_s {
 	struct llsim_output_s *next;
 } llsim_output_t;
 
+/*
+ * an input reads its value at *base + offset. unbound, that is its own
+ * oldp; llsim_bind points it into the producer's register block instead,
+ * so reading costs no copy and following the old/new swap of tracked
+ * blocks is free.
+ */
 typedef struct llsim_input_s {
 	char *unit_name;
 	char *input_name;
 	int bits;
 	void *oldp;
 	void *newp;
+	void **base;
+	int offset;
+	struct llsim_output_s *source;
 	struct llsim_input_s *next;
 } llsim_input_t;
 
+static inline void *llsim_input_data(llsim_input_t *input)
+{
+	return (char *) *input->base + input->offset;
+}
+
+/*
+ * combinational logic. a wire has a single storage copy, written once per
+ * cycle by the comb block driving it. comb blocks may only look at old
+ * registers and at the wires they declared with llsim_comb_reads; they are
+ * evaluated in dependency order at the start of every cycle, before any
+ * unit runs, so units see settled wires.
+ */
+struct llsim_comb_s;
+
+typedef struct llsim_wire_s {
+	char *unit_name;
+	char *wire_name;
+	int bits;
+	void *wirep;
+	struct llsim_comb_s *driver;
+	struct llsim_wire_s *next;
+} llsim_wire_t;
+
+typedef struct llsim_comb_read_s {
+	llsim_wire_t *wire;
+	struct llsim_comb_read_s *next;
+} llsim_comb_read_t;
+
+typedef struct llsim_comb_s {
+	char *name;
+	void (*eval) (struct llsim_unit_s *unit);
+	struct llsim_unit_s *unit;
+	llsim_comb_read_t *reads;
+
+	// depth first ordering state, see llsim_order_combs
+	int mark;
+	struct llsim_comb_s *parent;
+	llsim_wire_t *parent_wire;
+
+	struct llsim_comb_s *next;
+} llsim_comb_t;
+
+/*
+ * open addressing hash table. keys are interned names (compared by
+ * pointer) except in the intern table itself, where they are compared as
+ * strings.
+ */
+typedef struct llsim_hash_s {
+	int size;	// power of 2, 0 until the first insert
+	int count;
+	void **keys;
+	void **vals;
+} llsim_hash_t;
+
 /*
  * simulated unit
  */
 typedef struct llsim_unit_s {
+	struct llsim_s *sim;
 	char *name;
 	void (*run) (struct llsim_unit_s *unit);
+	void (*load) (struct llsim_unit_s *unit, char *program_name);
+	void (*reset_run) (struct llsim_unit_s *unit);	// back to the state right after load
+	void (*destroy) (struct llsim_unit_s *unit);	// releases what the unit holds outside the arena
+	void (*save) (struct llsim_unit_s *unit, FILE *fp);	// state kept outside registers and memories
+	void (*restore) (struct llsim_unit_s *unit, FILE *fp);
 	llsim_unit_registers_t *regs;
 	void *private;
 	llsim_memory_t *mems;
-	llsim_register_t *registers;
-	llsim_output_t *outputs;
-	llsim_input_t *inputs;
+	llsim_register_t *registers, **registers_tail;
+	llsim_output_t *outputs, **outputs_tail;
+	llsim_input_t *inputs, **inputs_tail;
+	llsim_wire_t *wires, **wires_tail;
+	llsim_comb_t *combs;
+	llsim_hash_t register_table, output_table, input_table, wire_table;
+	int period, phase;	// clock domain, see llsim_set_clock
+
+	// sleep state, see llsim_sleep_until
+	int asleep;
+	int wake_clock;
+	llsim_unit_registers_t *wake_regs;
+	int wake_offset, wake_size;
+	llsim_memory_t *wake_mem;
+
 	struct llsim_unit_s *next;
 } llsim_unit_t;
 
 /*
- * chip simulator main structure
+ * static schedule, built by llsim_finalize once all units are registered.
+ * units run in sched_units order, each followed by its memories
+ * sched_mems[mem_first .. mem_first+mem_count-1]. its register blocks are
+ * sched_regs[reg_first .. reg_first+reg_count-1].
+ */
+typedef struct llsim_sched_unit_s {
+	void (*run) (struct llsim_unit_s *unit);
+	llsim_unit_t *unit;
+	int edge;		// runs this tick
+	int mem_first;
+	int mem_count;
+	int reg_first;
+	int reg_count;
+} llsim_sched_unit_t;
+
+/*
+ * arena. everything a simulation allocates through llsim_malloc is carved
+ * out of large zeroed chunks, released in one go by llsim_destroy.
+ */
+#define LLSIM_ARENA_CHUNK	(256 * 1024)
+
+typedef struct llsim_arena_chunk_s {
+	struct llsim_arena_chunk_s *next;
+	long long pad;		// keeps allocations 16 byte aligned
+} llsim_arena_chunk_t;
+
+typedef struct llsim_arena_s {
+	llsim_arena_chunk_t *chunks;
+	char *cur;
+	size_t left;
+	size_t size;		// bytes held in chunks
+} llsim_arena_t;
+
+/*
+ * parallel unit evaluation state, see llsim_parallel
+ */
+typedef struct llsim_pool_s {
+	int nr_threads;		// including the thread calling llsim_run_clock
+	pthread_t *threads;
+	pthread_barrier_t start, done;
+	pthread_mutex_t lock;	// serializes arena allocations
+	int next;		// next sched_units index to evaluate
+	int quit;
+} llsim_pool_t;
+
+/*
+ * memory access log state, see llsim_memlog_open
+ */
+typedef struct llsim_memlog_s {
+	int level;
+	char *file_name;
+	FILE *fp;
+	struct llsim_memlog_rec_s *ring;
+	int head;
+	int wrapped;
+	int nr_names;
+} llsim_memlog_t;
+
+/*
+ * observer events, see llsim_observe. each type fills the fields listed
+ * next to it, on top of type, clock and the reporting unit.
+ */
+#define LLSIM_EVENT_RETIRE	0	// pc, inst: an instruction completed
+#define LLSIM_EVENT_MEM		1	// mem, port, write, addr, data, n: a port access resolved
+#define LLSIM_EVENT_STALL	2	// pc, stage: the instruction at stage holds
+#define LLSIM_EVENT_FLUSH	3	// stage, target: stages up to stage are dropped, fetch restarts at target
+#define LLSIM_EVENT_BRANCH	4	// pc, target, taken: a branch resolved
+#define LLSIM_EVENT_DMA		5	// from, to: the DMA changed state
+#define LLSIM_NR_EVENTS		6
+
+typedef struct llsim_event_s {
+	int type;
+	int clock;
+	struct llsim_unit_s *unit;	// NULL for memory events
+	int pc;
+	int inst;
+	int stage;
+	int target;
+	int taken;
+	int from, to;
+	struct llsim_memory_s *mem;
+	int port;
+	int write;
+	int addr;
+	int *data;		// n entries, valid during the callback only
+	int n;
+} llsim_event_t;
+
+typedef struct llsim_observer_s {
+	void (*fn) (llsim_event_t *event, void *arg);
+	void *arg;
+	struct llsim_observer_s *next;
+} llsim_observer_t;
+
+/*
+ * state hash log state, see llsim_hashlog_open
+ */
+typedef struct llsim_hashlog_s {
+	FILE *fp;
+	int rec_size;		// bytes per cycle record, 0 until the header is out
+	char *rec;
+	u64 *leaves;		// every cycle's state hash, for the tree written at close
+	int nr_leaves, max_leaves;
+} llsim_hashlog_t;
+
+/*
+ * run control state, see llsim_break
+ */
+typedef struct llsim_cond_s {
+	void **base;		// the register's old copy, as in llsim_register_t
+	int offset;
+	int op;
+	int value;
+	char *unit_name, *reg_name;
+	char *mem_name;		// a watchpoint still waiting for its memory
+	int mem_addr, mem_n;
+	struct llsim_cond_s *next;
+} llsim_cond_t;
+
+typedef struct llsim_runctl_s {
+	unsigned int *breaks;	// one bit per pc
+	int nr_break_words;
+	llsim_cond_t *conds;	// compiled, checked on every retire
+	int nr_conds;
+	llsim_cond_t *pending;	// conditions and watchpoints waiting for the model
+	int max_clocks, max_insts;
+	int insts;		// retired so far
+	int retire_observed;
+} llsim_runctl_t;
+
+typedef struct llsim_param_s {
+	char *name;
+	int value;
+	struct llsim_param_s *next;
+} llsim_param_t;
+
+/*
+ * chip simulator main structure. it holds everything about one
+ * simulation, so any number of them can run side by side, each on its
+ * own thread.
  */
 typedef struct llsim_s {
+	llsim_arena_t arena;
 	llsim_unit_t *units;
+	llsim_hash_t names;		// interned names
+	llsim_hash_t unit_table;
+	int nr_units;
+	int nr_mems;
+	int nr_regs;
+	int nr_combs;
+	int nr_asleep;
+	int multiclock;		// some unit or memory is off the base clock
+	int finalized;
+	llsim_sched_unit_t *sched_units;
+	llsim_memory_t **sched_mems;
+	llsim_unit_registers_t **sched_regs;
+	llsim_comb_t **sched_combs;	// levelized, drivers before readers
 	int clock;
 	int reset;
+	int stop;
+	char *output_prefix;	// prepended to the names of output files
+	llsim_param_t *params;
+	llsim_pool_t pool;
+	llsim_memlog_t memlog;
+	llsim_hashlog_t hashlog;
+	u64 state_hash;		// of the last clock, kept while a hash log is open
+	llsim_observer_t *observers[LLSIM_NR_EVENTS];
+	llsim_runctl_t runctl;
+	char *checkpoint_file;	// see llsim_checkpoint_every
+	int checkpoint_period;
+	int snapshot_protect;
+	struct llsim_snapshot_s *snapshots;
+	struct llsim_snapshot_s *pristine;	// memories right after llsim_load
 } llsim_t;
 
-llsim_t *llsim;
+/*
+ * life cycle: llsim_create, then parameters, parallel mode, memory log
+ * and output prefix, then llsim_init to build the model and load the
+ * program and llsim_run to simulate it until a unit calls llsim_stop, or
+ * llsim_checkpoint_restore and llsim_resume to carry on from a checkpoint
+ * instead. llsim_destroy frees it all.
+ *
+ * llsim_run is llsim_reset, the reset cycles, then llsim_resume. the
+ * reset cycles do not look at the memories, so a model built by
+ * llsim_init without a program may be reset first and given its program
+ * by llsim_load afterwards, as the server does.
+ *
+ * llsim_reset_run takes a simulation that has run back to where
+ * llsim_load left it: memories as loaded, from a snapshot taken then,
+ * idle ports, zeroed registers, clock 0 and the units' own state reset.
+ * the memories may be changed before llsim_run runs the program again.
+ * breakpoints, budgets, observers and open logs carry over.
+ */
+llsim_t *llsim_create(void);
+void llsim_init(llsim_t *sim, char *program_name);
+void llsim_load(llsim_t *sim, char *program_name);
+void llsim_reset(llsim_t *sim);
+void llsim_run(llsim_t *sim);
+void llsim_reset_run(llsim_t *sim);
+void llsim_destroy(llsim_t *sim);
+void llsim_set_output_prefix(llsim_t *sim, char *prefix);
+FILE *llsim_fopen(llsim_t *sim, char *name, char *mode);
 
-void *llsim_malloc(int len);
-llsim_unit_t *llsim_register_unit(char *name, void (*run) (struct llsim_unit_s *unit));
-llsim_unit_t *llsim_find_unit(char *name);
+void *llsim_malloc(llsim_t *sim, int len);
+llsim_unit_t *llsim_register_unit(llsim_t *sim, char *name, void (*run) (struct llsim_unit_s *unit));
+llsim_unit_t *llsim_find_unit(llsim_t *sim, char *name);
+char *llsim_intern(llsim_t *sim, char *name);
 llsim_unit_registers_t *llsim_allocate_registers(llsim_unit_t *unit, char *name, int size);
+void llsim_track_registers(llsim_unit_registers_t *ur);
 int generic_extract_bits(char *p, int msb, int lsb);
 void generic_inject_bits(char *p, int data, int msb, int lsb);
-void llsim_register_register(char *unit_name, char *reg_name, int bits, int reset_value, void *oldp, void *newp);
-void llsim_register_wire(char *unit_name, char *wire_name, int bits, void *wirep);
-void llsim_register_output(char *unit_name, char *output_name, int bits, void *oldp, void *newp);
-void llsim_register_input(char *unit_name, char *input_name, int bits, void *oldp, void *newp);
-void llsim_stop(void);
+void llsim_register_register(llsim_t *sim, char *unit_name, char *reg_name, int bits, int reset_value, void *oldp, void *newp, int flags);
+void llsim_trace_registers(llsim_unit_t *unit, FILE *fp);
+void llsim_register_wire(llsim_t *sim, char *unit_name, char *wire_name, int bits, void *wirep);
+void llsim_register_output(llsim_t *sim, char *unit_name, char *output_name, int bits, void *oldp, void *newp);
+void llsim_register_input(llsim_t *sim, char *unit_name, char *input_name, int bits, void *oldp, void *newp);
+llsim_register_t *llsim_find_register(llsim_unit_t *unit, char *reg_name);
+llsim_output_t *llsim_find_output(llsim_unit_t *unit, char *output_name);
+llsim_input_t *llsim_find_input(llsim_unit_t *unit, char *input_name);
+llsim_wire_t *llsim_find_wire(llsim_unit_t *unit, char *wire_name);
+void llsim_bind(llsim_t *sim, char *output_unit, char *output_name, char *input_unit, char *input_name);
+llsim_comb_t *llsim_register_comb(llsim_t *sim, char *unit_name, char *comb_name, void (*eval) (struct llsim_unit_s *unit));
+void llsim_comb_drives(llsim_comb_t *comb, char *unit_name, char *wire_name);
+void llsim_comb_reads(llsim_comb_t *comb, char *unit_name, char *wire_name);
+void llsim_finalize(llsim_t *sim);
+void llsim_stop(llsim_t *sim);
+
+/*
+ * event driven scheduling. a unit may put itself to sleep from its run
+ * function; it is skipped from the next cycle on until the first of its
+ * wake conditions holds: the given cycle starts, the watched register
+ * range commits a different value, or the watched memory is written.
+ * registers written in the cycle it went to sleep still commit. when
+ * every unit is asleep, llsim_fast_forward jumps the clock to the
+ * earliest wake cycle.
+ */
+void llsim_sleep_until(llsim_unit_t *unit, int clock);
+void llsim_sleep_on_registers(llsim_unit_t *unit, llsim_unit_registers_t *ur, void *p, int size);
+void llsim_sleep_on_memory(llsim_unit_t *unit, llsim_memory_t *mem);
+void llsim_wake(llsim_unit_t *unit);
+void llsim_fast_forward(llsim_t *sim);
+
+/*
+ * clock domains. sim->clock counts ticks of the fastest clock; a unit
+ * of period p and phase f has its edges on the ticks where clock % p == f,
+ * so a unit at twice the frequency of another has half its period. units
+ * only run, and their register blocks only commit, on their own edges.
+ * memories resolve on the edges of their owner unless given a clock of
+ * their own. a register block changes only at its owner's edge, after all
+ * units of that tick ran, so a unit in another domain samples it as of
+ * its own edge and never sees a half updated value.
+ */
+void llsim_set_clock(llsim_unit_t *unit, int period, int phase);
+void llsim_mem_set_clock(llsim_memory_t *memory, int period, int phase);
+
+/*
+ * model parameters, given as -p name=value on the command line
+ */
+void llsim_set_param(llsim_t *sim, char *name, int value);
+int llsim_param(llsim_t *sim, char *name, int default_value);
+
+/*
+ * observers. tools attach to the events a model reports without touching
+ * the model: llsim_observe adds a callback for one event type, called in
+ * the order attached. attach between clocks only. in parallel mode unit
+ * events are reported on the thread running the unit.
+ *
+ * models report through llsim_event, which only builds the event when
+ * someone observes it; otherwise it costs a load and a not-taken branch.
+ */
+void llsim_observe(llsim_t *sim, int type, void (*fn) (llsim_event_t *event, void *arg), void *arg);
+void llsim_notify(llsim_t *sim, llsim_event_t *event);
+
+static inline int llsim_observed(llsim_t *sim, int type)
+{
+	return __builtin_expect(sim->observers[type] != NULL, 0);
+}
+
+#define llsim_event(sim, unit_, type_, fields...)				\
+	do {									\
+		if (llsim_observed(sim, type_)) {				\
+			llsim_event_t event_ = { .type = type_, .clock = (sim)->clock, .unit = unit_, fields }; \
+			llsim_notify(sim, &event_);				\
+		}								\
+	} while (0)
+
+/*
+ * run control. a run ends when a unit calls llsim_stop or when one of
+ * these fires, after the clock it fired in; sim->stop tells which.
+ * llsim_resume carries on from there.
+ *
+ * breakpoints and register conditions are checked on every retired
+ * instruction (LLSIM_EVENT_RETIRE), as one bitmap lookup and a pass over
+ * the compiled conditions. watchpoints are a bitmap per memory checked on
+ * every resolved write. budgets count clocks and retired instructions.
+ * watchpoints and conditions given before llsim_init are resolved when
+ * the run starts.
+ */
+#define LLSIM_STOP_MODEL	1	// llsim_stop
+#define LLSIM_STOP_BREAK	2
+#define LLSIM_STOP_WATCH	3
+#define LLSIM_STOP_COND		4
+#define LLSIM_STOP_CLOCKS	5
+#define LLSIM_STOP_INSTS	6
+
+#define LLSIM_COND_EQ		0
+#define LLSIM_COND_NE		1
+#define LLSIM_COND_LT		2
+#define LLSIM_COND_LE		3
+#define LLSIM_COND_GT		4
+#define LLSIM_COND_GE		5
+
+void llsim_break(llsim_t *sim, int pc);
+void llsim_watch(llsim_t *sim, char *mem_name, int addr, int n);
+void llsim_break_if(llsim_t *sim, char *unit_name, char *reg_name, int op, int value);
+void llsim_set_budget(llsim_t *sim, int max_clocks, int max_insts);
+int llsim_run_control(llsim_t *sim, char *spec);
+void llsim_resume(llsim_t *sim);
+
+/*
+ * parallel mode: units of a cycle are evaluated concurrently by a pool
+ * of nr_threads threads (the caller included) and meet at a barrier
+ * before memories are resolved and registers committed. units must
+ * only depend on old registers and on memory contents as of the start
+ * of the cycle. two units requesting the same access on one memory in a
+ * cycle is reported as a conflict.
+ */
+void llsim_parallel(llsim_t *sim, int nr_threads);
+void llsim_parallel_stop(llsim_t *sim);
 
 /*
  * memories
  */
 llsim_memory_t *llsim_allocate_memory(llsim_unit_t *unit, char *name, int bits, int height, int dp);
-void llsim_mem_inject(llsim_memory_t *memory, int addr, int val, int msb, int lsb);
-int llsim_mem_extract(llsim_memory_t *memory, int addr, int msb, int lsb);
-void llsim_mem_set_datain(llsim_memory_t *memory, int val, int msb, int lsb);
 void llsim_mem_write(llsim_memory_t *memory, int addr);
 void llsim_mem_read(llsim_memory_t *memory, int addr);
-int llsim_mem_extract_dataout(llsim_memory_t *memory, int msb, int lsb);
-void llsim_run_clock(void);
+void llsim_mem_set_collision(llsim_memory_t *memory, int collision);
+void llsim_mem_set_latency(llsim_memory_t *memory, int read_latency, int write_latency, int depth);
+void llsim_mem_set_port_latency(llsim_memory_t *memory, int port, int read_latency, int write_latency, int depth);
+void llsim_mem_set_bandwidth(llsim_memory_t *memory, int words_per_cycle);
+void llsim_mem_read_burst_port(llsim_memory_t *memory, int port, int addr, int *buf, int n);
+void llsim_mem_write_burst_port(llsim_memory_t *memory, int port, int addr, int *buf, int n);
+void llsim_mem_read_burst(llsim_memory_t *memory, int addr, int *buf, int n);
+void llsim_mem_write_burst(llsim_memory_t *memory, int addr, int *buf, int n);
+void llsim_mem_write_port(llsim_memory_t *memory, int port, int addr);
+void llsim_mem_read_port(llsim_memory_t *memory, int port, int addr);
+void llsim_mem_inject_array(llsim_memory_t *memory, int addr, const int *vals, int n);
+void llsim_mem_extract_array(llsim_memory_t *memory, int addr, int *vals, int n);
+
+/*
+ * memory field accessors. these are inline so that the usual constant
+ * msb/lsb arguments specialize every call site.
+ */
+extern int llsim_zero_page[];
+int *llsim_mem_materialize(llsim_memory_t *memory, int page);
+int *llsim_mem_page_w(llsim_memory_t *memory, int page);
+
+#define llsim_mem_check_addr(memory, addr)						\
+	llsim_assert((unsigned int) (addr) < (unsigned int) (memory)->height,		\
+		     "mem %s address %d out of range\n", (memory)->name, addr)
+
+#define llsim_mem_check_field(memory, msb, lsb)						\
+	llsim_assert((lsb) >= 0 && (msb) >= (lsb) && (msb) - (lsb) < 32 &&		\
+		     ((msb) < 32 || (msb) < (memory)->entry_size * 32),			\
+		     "ERROR: field [%d:%d] invalid for memory %s\n", msb, lsb, (memory)->name)
+
+#define llsim_mem_check_port(memory, port)						\
+	llsim_assert((port) >= 0 && (port) < (memory)->nr_ports, "ERROR: memory %s has no port %d\n", (memory)->name, port)
+
+// entry for reading, untouched pages read as zero
+static inline int *llsim_mem_entry(llsim_memory_t *memory, int addr)
+{
+	return memory->pages[addr >> LLSIM_MEM_PAGE_SHIFT] + (addr & (LLSIM_MEM_PAGE_ENTRIES - 1)) * memory->entry_size;
+}
+
+// entry for writing, materializing its page and listing it as changed on the first write
+static inline int *llsim_mem_entry_w(llsim_memory_t *memory, int addr)
+{
+	int page = addr >> LLSIM_MEM_PAGE_SHIFT;
+
+	if (__builtin_expect((memory->page_dirty[page] & memory->page_track) != memory->page_track, 0))
+		llsim_mem_page_w(memory, page);
+	return memory->pages[page] + (addr & (LLSIM_MEM_PAGE_ENTRIES - 1)) * memory->entry_size;
+}
+
+static inline void llsim_mem_inject(llsim_memory_t *memory, int addr, int val, int msb, int lsb)
+{
+	llsim_mem_check_addr(memory, addr);
+	llsim_mem_check_field(memory, msb, lsb);
+	llsim_field_inject(llsim_mem_entry_w(memory, addr), val, msb, lsb);
+}
+
+static inline int llsim_mem_extract(llsim_memory_t *memory, int addr, int msb, int lsb)
+{
+	llsim_mem_check_addr(memory, addr);
+	llsim_mem_check_field(memory, msb, lsb);
+	return llsim_field_extract(llsim_mem_entry(memory, addr), msb, lsb);
+}
+
+static inline void llsim_mem_set_datain_port(llsim_memory_t *memory, int port, int val, int msb, int lsb)
+{
+	llsim_mem_check_port(memory, port);
+	llsim_mem_check_field(memory, msb, lsb);
+	llsim_field_inject(memory->port[port].datain, val, msb, lsb);
+}
+
+static inline int llsim_mem_extract_dataout_port(llsim_memory_t *memory, int port, int msb, int lsb)
+{
+	llsim_mem_check_port(memory, port);
+	llsim_mem_check_field(memory, msb, lsb);
+	return llsim_field_extract(memory->port[port].dataout, msb, lsb);
+}
+
+static inline int llsim_mem_ready_port(llsim_memory_t *memory, int port)
+{
+	llsim_mem_check_port(memory, port);
+	return memory->port[port].ready;
+}
+
+static inline int llsim_mem_valid_port(llsim_memory_t *memory, int port)
+{
+	llsim_mem_check_port(memory, port);
+	return memory->port[port].valid;
+}
+
+static inline int llsim_mem_ready(llsim_memory_t *memory)
+{
+	return llsim_mem_ready_port(memory, 0);
+}
+
+static inline int llsim_mem_valid(llsim_memory_t *memory)
+{
+	return llsim_mem_valid_port(memory, 0);
+}
+
+static inline void llsim_mem_set_datain(llsim_memory_t *memory, int val, int msb, int lsb)
+{
+	llsim_mem_set_datain_port(memory, 0, val, msb, lsb);
+}
+
+static inline int llsim_mem_extract_dataout(llsim_memory_t *memory, int msb, int lsb)
+{
+	return llsim_mem_extract_dataout_port(memory, 0, msb, lsb);
+}
+
+void llsim_run_clock(llsim_t *sim);
+
+/*
+ * memory access log
+ *
+ * every resolved memory access becomes a fixed size binary record in a
+ * preallocated ring. depending on the level the ring is drained to a file
+ * when it wraps, kept as a flight recorder of the last accesses, or
+ * bypassed in favour of the legacy per-access text lines.
+ */
+#define LLSIM_MEMLOG_OFF	0	// nothing recorded
+#define LLSIM_MEMLOG_RING	1	// last LLSIM_MEMLOG_ENTRIES records, written at exit
+#define LLSIM_MEMLOG_FILE	2	// every record drained to the log file
+#define LLSIM_MEMLOG_TEXT	3	// llsim_printf per access (old behaviour)
+
+#define LLSIM_MEMLOG_ENTRIES	(64 * 1024)	// must be a power of 2
+
+/*
+ * record types. an access to a wide memory is one record per 32 bit word,
+ * the word index kept above LLSIM_MEMLOG_WORD_SHIFT in type. a burst is
+ * a single record, without its data.
+ */
+#define LLSIM_MEMLOG_READ	0
+#define LLSIM_MEMLOG_WRITE	1
+#define LLSIM_MEMLOG_NAME	2	// mem = id, addr = entry words, data = name length, name bytes follow
+#define LLSIM_MEMLOG_BURST_READ	3	// addr = first entry, data = number of entries
+#define LLSIM_MEMLOG_BURST_WRITE	4
+#define LLSIM_MEMLOG_WORD_SHIFT	8
+
+#define LLSIM_MEMLOG_MAGIC	"LLSIMLOG"
+#define LLSIM_MEMLOG_VERSION	3
+
+typedef struct llsim_memlog_rec_s {
+	int clock;
+	unsigned short mem;
+	unsigned short type;
+	int addr;
+	int data;
+} llsim_memlog_rec_t;
+
+void llsim_memlog_open(llsim_t *sim, int level, char *file_name);
+void llsim_memlog_close(llsim_t *sim);
+int llsim_memlog_decode(char *file_name, FILE *out);
+
+/*
+ * state hash log
+ *
+ * with a hash log open, every clock ends by hashing the committed state:
+ * each register block in full and, per memory, only the pages written
+ * since the last clock, folded into a running memory hash. the log holds
+ * one fixed size record per clock (the state hash, the memory hashes and
+ * the register blocks) and, written at close, a Merkle tree over the
+ * state hashes.
+ *
+ * llsim_hashlog_bisect walks the trees of two logs down to the first
+ * clock whose state differs, reading O(log n) nodes, and prints the
+ * registered fields and memories that differ there.
+ */
+#define LLSIM_HASHLOG_MAGIC	"LLSIMHSH"
+#define LLSIM_HASHLOG_VERSION	1
+
+typedef struct llsim_hashlog_trailer_s {
+	i64 nr_leaves;
+	i64 records;		// file offset of the first record
+	i64 tree;		// file offset of the tree, level 1 first
+	char magic[8];
+} llsim_hashlog_trailer_t;
+
+void llsim_hashlog_open(llsim_t *sim, char *file_name);
+void llsim_hashlog_close(llsim_t *sim);
+int llsim_hashlog_bisect(char *file_name1, char *file_name2, FILE *out);
+
+/*
+ * checkpoints
+ *
+ * a checkpoint holds the whole state of a simulation between clocks:
+ * the clock, every register block, the materialized pages and pending
+ * port requests of every memory, the sleep state of every unit and
+ * whatever each unit's save hook adds. it restores into a simulation
+ * built by llsim_init from the same model and parameters, which then
+ * continues with llsim_resume exactly as the saved one would have.
+ *
+ * unit hooks write and read their own records with llsim_checkpoint_write
+ * and llsim_checkpoint_read; pointers into the unit (a burst buffer) are
+ * theirs to re-point on restore.
+ */
+#define LLSIM_CHECKPOINT_MAGIC		"LLSIMCKP"
+#define LLSIM_CHECKPOINT_VERSION	1
+
+void llsim_checkpoint_save(llsim_t *sim, char *file_name);
+void llsim_checkpoint_restore(llsim_t *sim, char *file_name);
+void llsim_checkpoint_every(llsim_t *sim, int period, char *file_name);
+void llsim_checkpoint_write(FILE *fp, const void *p, int len);
+void llsim_checkpoint_read(FILE *fp, void *p, int len);
+
+/*
+ * memory snapshots
+ *
+ * a snapshot holds the contents of every memory at the clock it was
+ * taken. snapshots share the pages that did not change between them, and
+ * taking one copies only the pages written since the previous one, so
+ * it is cheap enough to take every few thousand clocks. it restores the
+ * contents only; registers and port state are left as they are.
+ *
+ * pages written are found by the write path's bookkeeping, or, after
+ * llsim_snapshot_protect (before llsim_init), by write protecting the
+ * pages at each snapshot and catching the first write to each, which
+ * also catches writes through pointers from llsim_mem_entry.
+ */
+typedef struct llsim_snap_page_s {
+	int ref;
+	struct llsim_snap_page_s *next;		// on the free list of its memory
+	int data[] __attribute__ ((aligned (16)));
+} llsim_snap_page_t;
+
+typedef struct llsim_snapshot_s {
+	llsim_t *sim;
+	int clock;
+	int ***pages;		// page table per memory, in schedule order
+	struct llsim_snapshot_s *next;
+} llsim_snapshot_t;
+
+void llsim_snapshot_protect(llsim_t *sim);
+llsim_snapshot_t *llsim_snapshot(llsim_t *sim);
+void llsim_snapshot_restore(llsim_snapshot_t *snap);
+void llsim_snapshot_free(llsim_snapshot_t *snap);
+int *llsim_snapshot_entry(llsim_snapshot_t *snap, llsim_memory_t *memory, int addr);
+
+/*
+ * simulation server
+ *
+ * llsim_serve builds and resets the model once, then listens on a unix
+ * socket. each job forks the warm model, loads its program and runs it
+ * with its own run options in the client's working directory, writing
+ * to the client's stdout and stderr, passed along with the request. the
+ * client gets the job's exit status back when it is done.
+ *
+ * a request is an int length, sent with the two descriptors, then that
+ * many bytes: the working directory and the arguments, each followed by
+ * a NUL.
+ */
+#define LLSIM_SERVER_MAX_REQUEST	65536
+
+int llsim_serve(llsim_t *sim, char *socket_name, int (*job) (llsim_t *sim, int argc, char **argv));
+int llsim_submit(char *socket_name, int argc, char **argv);
 #endif
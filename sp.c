@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -10,17 +11,13 @@
 
 #define sp_printf(a...)						\
 	do {							\
-		llsim_printf("sp: clock %d: ", llsim->clock);	\
+		llsim_printf("sp: clock %d: ", sp->sim->clock);	\
 		llsim_printf(a);				\
 	} while (0)
 
-int nr_simulated_instructions = 0;
-FILE *inst_trace_fp = NULL, *cycle_trace_fp = NULL;
-
 // our code BEGIN
 
 // branch prediction
-int branch_counter = 0;     // simple 2-bit branch predictor
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
@@ -47,6 +44,9 @@ int branch_counter = 0;     // simple 2-bit branch predictor
 
 // our code END
 
+// write a field of the next cycle registers, recording it for the commit
+#define SPRN(field) (*(llsim_reg_track(sp->regs, &sprn->field, sizeof(sprn->field)), &sprn->field))
+
 typedef struct sp_registers_s {
     // 6 32 bit registers (r[0], r[1] don't exist)
     int r[8];
@@ -115,26 +115,114 @@ typedef struct sp_registers_s {
 
 } sp_registers_t;
 
+/*
+ * name, width and trace flag of every field of sp_registers_t. the cycle
+ * trace prints the traced ones in this order.
+ */
+typedef struct sp_field_s {
+    char *name;
+    int offset;
+    int bits;
+    int flags;
+} sp_field_t;
+
+#define SP_FIELD(field, bits, flags)	{ #field, offsetof(sp_registers_t, field), bits, flags }
+#define SP_GPR(i, flags)		{ "r" #i, offsetof(sp_registers_t, r[i]), 32, flags }
+#define T LLSIM_REG_TRACE
+
+static sp_field_t sp_fields[] = {
+    SP_FIELD(cycle_counter, 32, T),
+    SP_GPR(0, 0), SP_GPR(1, 0),
+    SP_GPR(2, T), SP_GPR(3, T), SP_GPR(4, T), SP_GPR(5, T), SP_GPR(6, T), SP_GPR(7, T),
+
+    SP_FIELD(fetch0_active, 1, T),
+    SP_FIELD(fetch0_pc, 16, T),
+
+    SP_FIELD(fetch1_active, 1, T),
+    SP_FIELD(fetch1_pc, 16, T),
+
+    SP_FIELD(dec0_active, 1, T),
+    SP_FIELD(dec0_pc, 16, T),
+    SP_FIELD(dec0_inst, 32, T),
+
+    SP_FIELD(dec1_active, 1, T),
+    SP_FIELD(dec1_pc, 16, T),
+    SP_FIELD(dec1_inst, 32, T),
+    SP_FIELD(dec1_opcode, 5, T),
+    SP_FIELD(dec1_src0, 3, T),
+    SP_FIELD(dec1_src1, 3, T),
+    SP_FIELD(dec1_dst, 3, T),
+    SP_FIELD(dec1_immediate, 32, T),
+
+    SP_FIELD(exec0_active, 1, T),
+    SP_FIELD(exec0_pc, 16, T),
+    SP_FIELD(exec0_inst, 32, T),
+    SP_FIELD(exec0_opcode, 5, T),
+    SP_FIELD(exec0_src0, 3, T),
+    SP_FIELD(exec0_src1, 3, T),
+    SP_FIELD(exec0_dst, 3, T),
+    SP_FIELD(exec0_immediate, 32, T),
+    SP_FIELD(exec0_alu0, 32, T),
+    SP_FIELD(exec0_alu1, 32, T),
+
+    SP_FIELD(exec1_active, 1, T),
+    SP_FIELD(exec1_pc, 16, T),
+    SP_FIELD(exec1_inst, 32, T),
+    SP_FIELD(exec1_opcode, 5, T),
+    SP_FIELD(exec1_src0, 3, T),
+    SP_FIELD(exec1_src1, 3, T),
+    SP_FIELD(exec1_dst, 3, T),
+    SP_FIELD(exec1_immediate, 32, T),
+    SP_FIELD(exec1_alu0, 32, T),
+    SP_FIELD(exec1_alu1, 32, T),
+    SP_FIELD(exec1_aluout, 32, T),
+
+    // our code BEGIN
+    SP_FIELD(dma_busy, 1, 0),
+    SP_FIELD(dma_src, 16, 0),
+    SP_FIELD(dma_dst, 16, 0),
+    SP_FIELD(dma_len, 16, 0),
+    SP_FIELD(dma_state, 2, 0),
+    // our code END
+};
+
+#undef T
+
 /*
  * Master structure
  */
 typedef struct sp_s {
+    llsim_t *sim;
+    llsim_unit_t *unit;
+    FILE *inst_trace_fp, *cycle_trace_fp;
+
     // local srams
 #define SP_SRAM_HEIGHT	64 * 1024
     llsim_memory_t *srami, *sramd;
 
-    unsigned int memory_image[SP_SRAM_HEIGHT];
+    char *program_name;
     int memory_image_size;
 
     int start;
 
+    llsim_unit_registers_t *regs;
     sp_registers_t *spro, *sprn;
 
     // our code BEGIN
 
+    int branch_counter;     // simple 2-bit branch predictor
+    int inst_count;         // count number of instructions executed
+
     // DMA control signals
     int dma_start;  // "kick" to trigger DMA activation
     int mem_busy;   // is SRAM currently busy
+    int dma_port;   // sramd port used by the DMA, 0 is shared with the core
+    int dma_fetch_src;  // address FETCH read on the DMA's own port
+    int dma_fetch_dst;  // where COPY writes what FETCH read
+    int dma_fetch_n;    // entries FETCH read
+    int dma_burst;  // words per cycle when the DMA copies in bursts, 0 copies word by word
+#define SP_DMA_BURST	32
+    int dma_buf[SP_DMA_BURST];  // holds a burst between its read and its write
 
     // our code END
 
@@ -145,6 +233,7 @@ static void sp_reset(sp_t *sp)
     sp_registers_t *sprn = sp->sprn;
 
     memset(sprn, 0, sizeof(*sprn));
+    llsim_reg_track_all(sp->regs);
 }
 
 /*
@@ -184,8 +273,6 @@ static char opcode_name[32][4] = {"ADD", "SUB", "LSF", "RSF", "AND", "OR", "XOR"
 #define  IS_COND_BRANCH(opcode) ((opcode) == JLT || (opcode) == JLE || (opcode) == JEQ || (opcode) == JNE)
 #define  IS_UNCOND_BRANCH(opcode) ((opcode) == JIN)
 
-int inst_count; // count number of instructions executed
-
 // HAZARD CHECKING FUNCTIONS
 
 // check for possible hazards in DEC0 stage
@@ -292,52 +379,54 @@ void stall(sp_t *sp, int stage) {
     sp_registers_t *spro = sp->spro;
     sp_registers_t *sprn = sp->sprn;
 
+    llsim_event(sp->sim, sp->unit, LLSIM_EVENT_STALL, .pc = (stage == DEC0 ? spro->dec0_pc : spro->dec1_pc), .stage = stage);
+
     switch (stage) {
         // replace command with NOP
         case DEC1:
-            sprn->exec1_active = 0;
-
-            sprn->exec0_active = 1;
-            sprn->exec0_pc = 0;
-            sprn->exec0_inst = 0;
-            sprn->exec0_opcode = NOP;
-            sprn->exec0_dst = 0;
-            sprn->exec0_src0 = 0;
-            sprn->exec0_src1 = 0;
-            sprn->exec0_immediate = 0;
-
-            sprn->fetch0_active = spro->fetch0_active;
-            sprn->fetch0_pc = spro->fetch0_pc;
-
-            sprn->fetch1_active = spro->fetch1_active;
-            sprn->fetch1_pc = spro->fetch1_pc;
-
-            sprn->dec0_active = spro->dec0_active;
-            sprn->dec0_pc = spro->dec0_pc;
-            sprn->dec0_inst = spro->dec0_inst;
-
-            sprn->dec1_active = spro->dec1_active;
-            sprn->dec1_pc = spro->dec1_pc;
-            sprn->dec1_inst = spro->dec1_inst;
-            sprn->dec1_opcode = spro->dec1_opcode;
-            sprn->dec1_dst = spro->dec1_dst;
-            sprn->dec1_src0 = spro->dec1_src0;
-            sprn->dec1_src1 = spro->dec1_src1;
-            sprn->dec1_immediate = spro->dec1_immediate;
+            SPRN(exec1_active) = 0;
+
+            SPRN(exec0_active) = 1;
+            SPRN(exec0_pc) = 0;
+            SPRN(exec0_inst) = 0;
+            SPRN(exec0_opcode) = NOP;
+            SPRN(exec0_dst) = 0;
+            SPRN(exec0_src0) = 0;
+            SPRN(exec0_src1) = 0;
+            SPRN(exec0_immediate) = 0;
+
+            SPRN(fetch0_active) = spro->fetch0_active;
+            SPRN(fetch0_pc) = spro->fetch0_pc;
+
+            SPRN(fetch1_active) = spro->fetch1_active;
+            SPRN(fetch1_pc) = spro->fetch1_pc;
+
+            SPRN(dec0_active) = spro->dec0_active;
+            SPRN(dec0_pc) = spro->dec0_pc;
+            SPRN(dec0_inst) = spro->dec0_inst;
+
+            SPRN(dec1_active) = spro->dec1_active;
+            SPRN(dec1_pc) = spro->dec1_pc;
+            SPRN(dec1_inst) = spro->dec1_inst;
+            SPRN(dec1_opcode) = spro->dec1_opcode;
+            SPRN(dec1_dst) = spro->dec1_dst;
+            SPRN(dec1_src0) = spro->dec1_src0;
+            SPRN(dec1_src1) = spro->dec1_src1;
+            SPRN(dec1_immediate) = spro->dec1_immediate;
             break;
 
         // freeze pipeline for 1 cycle
         case DEC0:
-            sprn->fetch0_active = spro->fetch1_active;
-            sprn->fetch0_pc = spro->fetch1_pc;
+            SPRN(fetch0_active) = spro->fetch1_active;
+            SPRN(fetch0_pc) = spro->fetch1_pc;
 
-            sprn->fetch1_active = 0;
+            SPRN(fetch1_active) = 0;
 
-            sprn->dec0_active = spro->dec0_active;
-            sprn->dec0_pc = spro->dec0_pc;
-            sprn->dec0_inst = spro->dec0_inst;
+            SPRN(dec0_active) = spro->dec0_active;
+            SPRN(dec0_pc) = spro->dec0_pc;
+            SPRN(dec0_inst) = spro->dec0_inst;
 
-            sprn->dec1_active = 0;
+            SPRN(dec1_active) = 0;
             break;
 
         // invalid pipeline stage
@@ -351,24 +440,26 @@ void stall(sp_t *sp, int stage) {
 void flush(sp_t *sp, int stage, int pc) {
     sp_registers_t *sprn = sp->sprn;
 
+    llsim_event(sp->sim, sp->unit, LLSIM_EVENT_FLUSH, .stage = stage, .target = pc);
+
     switch (stage) {
         // flush pipeline and fetch from PC
         case DEC0:
-            sprn->fetch0_active = 1;
-            sprn->fetch0_pc = pc;
-            sprn->fetch1_active = 0;
-            sprn->dec0_active = 0;
+            SPRN(fetch0_active) = 1;
+            SPRN(fetch0_pc) = pc;
+            SPRN(fetch1_active) = 0;
+            SPRN(dec0_active) = 0;
             break;
 
         // flush pipeline and fetch from PC
         case EXEC1:
-            sprn->exec1_active = 0;
-            sprn->exec0_active = 0;
-            sprn->dec1_active = 0;
-            sprn->dec0_active = 0;
-            sprn->fetch1_active = 0;
-            sprn->fetch0_active = 1;
-            sprn->fetch0_pc = pc;
+            SPRN(exec1_active) = 0;
+            SPRN(exec0_active) = 0;
+            SPRN(dec1_active) = 0;
+            SPRN(dec0_active) = 0;
+            SPRN(fetch1_active) = 0;
+            SPRN(fetch0_active) = 1;
+            SPRN(fetch0_pc) = pc;
             break;
 
         default:
@@ -389,18 +480,20 @@ void branch(sp_t *sp) {
     if (IS_COND_BRANCH(spro->exec1_opcode)) {
         // update r[7] upon branch taken
         if (spro->exec1_aluout)
-            sprn->r[7] = spro->exec1_pc;
+            SPRN(r[7]) = spro->exec1_pc;
 
         // update pc and branch counter: (taken ? Yes : No);
         // MIN and MAX to prevent a 2-bit overflow
         pc = spro->exec1_aluout ? (spro->exec1_immediate & 0xffff) : spro->exec1_pc + 1;
-        branch_counter = spro->exec1_aluout ? MAX(3, branch_counter+1) : MIN(0, branch_counter-1);
+        sp->branch_counter = spro->exec1_aluout ? MAX(3, sp->branch_counter+1) : MIN(0, sp->branch_counter-1);
     }
     // JIN
     else {
-        sprn->r[7] = spro->exec1_pc;
+        SPRN(r[7]) = spro->exec1_pc;
         pc = spro->exec1_alu0 & 0xffff;
     }
+    llsim_event(sp->sim, sp->unit, LLSIM_EVENT_BRANCH, .pc = spro->exec1_pc, .target = pc,
+                .taken = !IS_COND_BRANCH(spro->exec1_opcode) || spro->exec1_aluout);
 
     // if branch is taken pipeline has to be flushed and fetch instruction from correct address
     if ((spro->fetch0_active && (spro->fetch0_pc != pc)) ||
@@ -419,24 +512,24 @@ void print_trace(sp_t *sp) {
     sp_registers_t *spro = sp->spro;
 
     // print header
-    fprintf(inst_trace_fp, "--- instruction %d (%04x) @ PC %d (%04x) -----------------------------------------------------------\n",
-            inst_count, inst_count, spro->exec1_pc, spro->exec1_pc);
-    fprintf(inst_trace_fp, "pc = %04d, ", spro->exec1_pc);
-    fprintf(inst_trace_fp, "inst = %08x, ", spro->exec1_inst);
-    fprintf(inst_trace_fp, "opcode = %d (%s), ", spro->exec1_opcode, opcode_name[spro->exec1_opcode]);
-    fprintf(inst_trace_fp, "dst = %d, ", spro->exec1_dst);
-    fprintf(inst_trace_fp, "src0 = %d, ", spro->exec1_src0);
-    fprintf(inst_trace_fp, "src1 = %d, ", spro->exec1_src1);
-    fprintf(inst_trace_fp, "immediate = %08x\n", spro->exec1_immediate);
+    fprintf(sp->inst_trace_fp, "--- instruction %d (%04x) @ PC %d (%04x) -----------------------------------------------------------\n",
+            sp->inst_count, sp->inst_count, spro->exec1_pc, spro->exec1_pc);
+    fprintf(sp->inst_trace_fp, "pc = %04d, ", spro->exec1_pc);
+    fprintf(sp->inst_trace_fp, "inst = %08x, ", spro->exec1_inst);
+    fprintf(sp->inst_trace_fp, "opcode = %d (%s), ", spro->exec1_opcode, opcode_name[spro->exec1_opcode]);
+    fprintf(sp->inst_trace_fp, "dst = %d, ", spro->exec1_dst);
+    fprintf(sp->inst_trace_fp, "src0 = %d, ", spro->exec1_src0);
+    fprintf(sp->inst_trace_fp, "src1 = %d, ", spro->exec1_src1);
+    fprintf(sp->inst_trace_fp, "immediate = %08x\n", spro->exec1_immediate);
 
     // print register content
-    fprintf(inst_trace_fp, "r[0] = 00000000 ");
-    fprintf(inst_trace_fp, "r[1] = %08x ", spro->exec1_immediate);
+    fprintf(sp->inst_trace_fp, "r[0] = 00000000 ");
+    fprintf(sp->inst_trace_fp, "r[1] = %08x ", spro->exec1_immediate);
     for (int i=2; i<8; i++) {
-        fprintf(inst_trace_fp, "r[%d] = %08x ", i, spro->r[i]);
-        if ((i+1) % (8/2) == 0) fprintf(inst_trace_fp, "\n");
+        fprintf(sp->inst_trace_fp, "r[%d] = %08x ", i, spro->r[i]);
+        if ((i+1) % (8/2) == 0) fprintf(sp->inst_trace_fp, "\n");
     }
-    fprintf(inst_trace_fp, "\n");
+    fprintf(sp->inst_trace_fp, "\n");
 
     // print operation summary
     switch (spro->exec1_opcode) {
@@ -447,28 +540,28 @@ void print_trace(sp_t *sp) {
         case AND:
         case OR:
         case XOR:
-            fprintf(inst_trace_fp, ">>>> EXEC: R[%d] = %d %s %d <<<<\n\n", spro->exec1_dst, spro->exec1_alu0, opcode_name[spro->exec1_opcode], spro->exec1_alu1);
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: R[%d] = %d %s %d <<<<\n\n", spro->exec1_dst, spro->exec1_alu0, opcode_name[spro->exec1_opcode], spro->exec1_alu1);
             break;
         case LHI:
-            fprintf(inst_trace_fp, ">>>> EXEC: R[%d][31:16] = immediate[15:0] <<<<\n\n", spro->exec1_dst);
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: R[%d][31:16] = immediate[15:0] <<<<\n\n", spro->exec1_dst);
             break;
         case LD:
-            fprintf(inst_trace_fp, ">>>> EXEC: R[%d] = MEM[%d] = %08x <<<<\n\n", spro->exec1_dst, spro->exec1_alu1, llsim_mem_extract_dataout(sp->sramd, 31, 0));
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: R[%d] = MEM[%d] = %08x <<<<\n\n", spro->exec1_dst, spro->exec1_alu1, llsim_mem_extract_dataout(sp->sramd, 31, 0));
             break;
         case ST:
-            fprintf(inst_trace_fp, ">>>> EXEC: MEM[%d] = R[%d] = %08x <<<<\n\n", spro->exec1_alu1, spro->exec1_src0, spro->exec1_alu0);
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: MEM[%d] = R[%d] = %08x <<<<\n\n", spro->exec1_alu1, spro->exec1_src0, spro->exec1_alu0);
             break;
         case JLT:
         case JLE:
         case JEQ:
         case JNE:
-            fprintf(inst_trace_fp, ">>>> EXEC: %s %d, %d, %d <<<<\n\n", opcode_name[spro->exec1_opcode], spro->exec1_alu0, spro->exec1_alu1, (spro->exec1_aluout ? spro->exec1_immediate & 0xffff : spro->exec1_pc + 1));
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: %s %d, %d, %d <<<<\n\n", opcode_name[spro->exec1_opcode], spro->exec1_alu0, spro->exec1_alu1, (spro->exec1_aluout ? spro->exec1_immediate & 0xffff : spro->exec1_pc + 1));
             break;
         case JIN:
-            fprintf(inst_trace_fp, ">>>> EXEC: JIN %d <<<<\n\n", spro->exec1_immediate);
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: JIN %d <<<<\n\n", spro->exec1_immediate);
             break;
         case HLT:
-            fprintf(inst_trace_fp, ">>>> EXEC: HALT at PC %04x<<<<\n", spro->exec1_pc);
+            fprintf(sp->inst_trace_fp, ">>>> EXEC: HALT at PC %04x<<<<\n", spro->exec1_pc);
             break;
     }
 }
@@ -477,63 +570,134 @@ void print_trace(sp_t *sp) {
 static void dump_sram(sp_t *sp, char *name, llsim_memory_t *sram)
 {
     FILE *fp;
-    int i;
+    int chunk[LLSIM_MEM_PAGE_ENTRIES];
+    int i, j;
 
-    fp = fopen(name, "w");
+    fp = llsim_fopen(sp->sim, name, "w");
     if (fp == NULL) {
         printf("couldn't open file %s\n", name);
         exit(1);
     }
-    for (i = 0; i < SP_SRAM_HEIGHT; i++)
-        fprintf(fp, "%08x\n", llsim_mem_extract(sram, i, 31, 0));
+    for (i = 0; i < SP_SRAM_HEIGHT; i += LLSIM_MEM_PAGE_ENTRIES) {
+        llsim_mem_extract_array(sram, i, chunk, LLSIM_MEM_PAGE_ENTRIES);
+        for (j = 0; j < LLSIM_MEM_PAGE_ENTRIES; j++)
+            fprintf(fp, "%08x\n", chunk[j]);
+    }
     fclose(fp);
 }
 
 // our code BEGIN
 
+// entries in the next DMA burst. a destination just ahead of the source
+// is not read before it was written, as with the word by word copy
+static int dma_burst_len(sp_registers_t *spro) {
+    int n = MIN(spro->dma_len + 1, SP_DMA_BURST);
+
+    if (spro->dma_dst > spro->dma_src && spro->dma_dst - spro->dma_src < n)
+        n = spro->dma_dst - spro->dma_src;
+    return n;
+}
+
 // state machine for DMA
 void dma_ctl(sp_t *sp) {
     sp_registers_t* spro = sp->spro;
     sp_registers_t* sprn = sp->sprn;
 
-    int dataout;
+    int dataout, n;
 
     switch (spro->dma_state) {
         case DMA_STATE_IDLE:
-            sprn->dma_busy = 0;
+            SPRN(dma_busy) = 0;
 
             // if DMA command then set busy and goto next state
             if (sp->dma_start) {
-                sprn->dma_state = DMA_STATE_FETCH;
-                sprn->dma_busy = 1;
+                SPRN(dma_state) = DMA_STATE_FETCH;
+                SPRN(dma_busy) = 1;
             }
             break;
 
         case DMA_STATE_FETCH:
+            // with its own port the DMA never waits for the core
+            if (sp->dma_port) {
+                if (!llsim_mem_ready_port(sp->sramd, sp->dma_port))
+                    break;
+                sp->dma_fetch_src = spro->dma_src;
+                sp->dma_fetch_dst = spro->dma_dst;
+                sp->dma_fetch_n = sp->dma_burst ? dma_burst_len(spro) : 1;
+                if (sp->dma_burst)
+                    llsim_mem_read_burst_port(sp->sramd, sp->dma_port, sp->dma_fetch_src, sp->dma_buf, sp->dma_fetch_n);
+                else
+                    llsim_mem_read_port(sp->sramd, sp->dma_port, sp->dma_fetch_src);
+                SPRN(dma_state) = DMA_STATE_COPY;
+                break;
+            }
+
             // read next address if SRAM is free
             if (!sp->mem_busy){
                 llsim_mem_read(sp->sramd, spro->dma_src);
             }
 
             // proceed to next state (WAIT if SRAM is busy otherwise COPY)
-            sprn->dma_state = (sp->mem_busy ? DMA_STATE_WAIT : DMA_STATE_COPY);
+            SPRN(dma_state) = (sp->mem_busy ? DMA_STATE_WAIT : DMA_STATE_COPY);
             break;
 
         case DMA_STATE_WAIT:
+            // a burst copy waits here for its last write to land
+            if (sp->dma_burst) {
+                SPRN(dma_state) = (llsim_mem_ready_port(sp->sramd, sp->dma_port) ? DMA_STATE_IDLE : DMA_STATE_WAIT);
+                break;
+            }
+
             // proceed to next state (WAIT if SRAM is still busy, otherwise FETCH)
-            sprn->dma_state = (sp->mem_busy ? DMA_STATE_WAIT : DMA_STATE_FETCH);
+            SPRN(dma_state) = (sp->mem_busy ? DMA_STATE_WAIT : DMA_STATE_FETCH);
             break;
 
         case DMA_STATE_COPY:
-            // copy current address from SRAM to DMA's destination
-            dataout = llsim_mem_extract(sp->sramd, spro->dma_src, 31, 0);
-            llsim_mem_set_datain(sp->sramd, dataout, 31, 0);
-            llsim_mem_write(sp->sramd, spro->dma_dst);
+            // write back a burst once it has been read
+            if (sp->dma_burst) {
+                if (!llsim_mem_ready_port(sp->sramd, sp->dma_port))
+                    break;
+                // a CPY since FETCH moved the copy, the burst read is stale
+                n = sp->dma_fetch_n;
+                if (spro->dma_src != sp->dma_fetch_src || spro->dma_dst != sp->dma_fetch_dst || dma_burst_len(spro) != n) {
+                    SPRN(dma_state) = DMA_STATE_FETCH;
+                    break;
+                }
+                llsim_mem_write_burst_port(sp->sramd, sp->dma_port, sp->dma_fetch_dst, sp->dma_buf, n);
+                SPRN(dma_src) = sp->dma_fetch_src + n;
+                SPRN(dma_dst) = sp->dma_fetch_dst + n;
+                SPRN(dma_len) = spro->dma_len - n;
+                if (spro->dma_len < n)
+                    sp->dma_start = 0;
+                SPRN(dma_state) = (spro->dma_len < n ? DMA_STATE_WAIT : DMA_STATE_FETCH);
+                break;
+            }
+
+            // copy current address from SRAM to DMA's destination. on its own
+            // port the data is what FETCH read, a shared port may have been
+            // used by the core since
+            if (sp->dma_port) {
+                // a slow port holds the data back for a few cycles
+                if (!llsim_mem_valid_port(sp->sramd, sp->dma_port) || !llsim_mem_ready_port(sp->sramd, sp->dma_port))
+                    break;
+                // a CPY since FETCH moved the source, read it again
+                if (spro->dma_src != sp->dma_fetch_src) {
+                    SPRN(dma_state) = DMA_STATE_FETCH;
+                    break;
+                }
+                dataout = llsim_mem_extract_dataout_port(sp->sramd, sp->dma_port, 31, 0);
+                llsim_mem_set_datain_port(sp->sramd, sp->dma_port, dataout, 31, 0);
+                llsim_mem_write_port(sp->sramd, sp->dma_port, spro->dma_dst);
+            } else {
+                dataout = llsim_mem_extract(sp->sramd, spro->dma_src, 31, 0);
+                llsim_mem_set_datain(sp->sramd, dataout, 31, 0);
+                llsim_mem_write(sp->sramd, spro->dma_dst);
+            }
 
             // advance pointers to next address
-            sprn->dma_src = spro->dma_src + 1;
-            sprn->dma_dst = spro->dma_dst + 1;
-            sprn->dma_len = spro->dma_len - 1;
+            SPRN(dma_src) = spro->dma_src + 1;
+            SPRN(dma_dst) = spro->dma_dst + 1;
+            SPRN(dma_len) = spro->dma_len - 1;
 
             // deactivate DMA upon completion
             if (spro->dma_len == 0) {
@@ -541,11 +705,14 @@ void dma_ctl(sp_t *sp) {
             }
 
             // proceed to next state (IDLE if completed, otherwise FETCH)
-            sprn->dma_state = (spro->dma_len == 0 ? DMA_STATE_IDLE : DMA_STATE_FETCH);
+            SPRN(dma_state) = (spro->dma_len == 0 ? DMA_STATE_IDLE : DMA_STATE_FETCH);
 
             break;
 
     }
+
+    if (llsim_observed(sp->sim, LLSIM_EVENT_DMA) && sprn->dma_state != spro->dma_state)
+        llsim_event(sp->sim, sp->unit, LLSIM_EVENT_DMA, .from = spro->dma_state, .to = sprn->dma_state);
 }
 
 // our code END
@@ -554,56 +721,10 @@ static void sp_ctl(sp_t *sp)
 {
     sp_registers_t *spro = sp->spro;
     sp_registers_t *sprn = sp->sprn;
-    int i;
 
-    fprintf(cycle_trace_fp, "cycle %d\n", spro->cycle_counter);
-    fprintf(cycle_trace_fp, "cycle_counter %08x\n", spro->cycle_counter);
-    for (i = 2; i <= 7; i++)
-        fprintf(cycle_trace_fp, "r%d %08x\n", i, spro->r[i]);
-
-    fprintf(cycle_trace_fp, "fetch0_active %08x\n", spro->fetch0_active);
-    fprintf(cycle_trace_fp, "fetch0_pc %08x\n", spro->fetch0_pc);
-
-    fprintf(cycle_trace_fp, "fetch1_active %08x\n", spro->fetch1_active);
-    fprintf(cycle_trace_fp, "fetch1_pc %08x\n", spro->fetch1_pc);
-
-    fprintf(cycle_trace_fp, "dec0_active %08x\n", spro->dec0_active);
-    fprintf(cycle_trace_fp, "dec0_pc %08x\n", spro->dec0_pc);
-    fprintf(cycle_trace_fp, "dec0_inst %08x\n", spro->dec0_inst); // 32 bits
-
-    fprintf(cycle_trace_fp, "dec1_active %08x\n", spro->dec1_active);
-    fprintf(cycle_trace_fp, "dec1_pc %08x\n", spro->dec1_pc); // 16 bits
-    fprintf(cycle_trace_fp, "dec1_inst %08x\n", spro->dec1_inst); // 32 bits
-    fprintf(cycle_trace_fp, "dec1_opcode %08x\n", spro->dec1_opcode); // 5 bits
-    fprintf(cycle_trace_fp, "dec1_src0 %08x\n", spro->dec1_src0); // 3 bits
-    fprintf(cycle_trace_fp, "dec1_src1 %08x\n", spro->dec1_src1); // 3 bits
-    fprintf(cycle_trace_fp, "dec1_dst %08x\n", spro->dec1_dst); // 3 bits
-    fprintf(cycle_trace_fp, "dec1_immediate %08x\n", spro->dec1_immediate); // 32 bits
-
-    fprintf(cycle_trace_fp, "exec0_active %08x\n", spro->exec0_active);
-    fprintf(cycle_trace_fp, "exec0_pc %08x\n", spro->exec0_pc); // 16 bits
-    fprintf(cycle_trace_fp, "exec0_inst %08x\n", spro->exec0_inst); // 32 bits
-    fprintf(cycle_trace_fp, "exec0_opcode %08x\n", spro->exec0_opcode); // 5 bits
-    fprintf(cycle_trace_fp, "exec0_src0 %08x\n", spro->exec0_src0); // 3 bits
-    fprintf(cycle_trace_fp, "exec0_src1 %08x\n", spro->exec0_src1); // 3 bits
-    fprintf(cycle_trace_fp, "exec0_dst %08x\n", spro->exec0_dst); // 3 bits
-    fprintf(cycle_trace_fp, "exec0_immediate %08x\n", spro->exec0_immediate); // 32 bits
-    fprintf(cycle_trace_fp, "exec0_alu0 %08x\n", spro->exec0_alu0); // 32 bits
-    fprintf(cycle_trace_fp, "exec0_alu1 %08x\n", spro->exec0_alu1); // 32 bits
-
-    fprintf(cycle_trace_fp, "exec1_active %08x\n", spro->exec1_active);
-    fprintf(cycle_trace_fp, "exec1_pc %08x\n", spro->exec1_pc); // 16 bits
-    fprintf(cycle_trace_fp, "exec1_inst %08x\n", spro->exec1_inst); // 32 bits
-    fprintf(cycle_trace_fp, "exec1_opcode %08x\n", spro->exec1_opcode); // 5 bits
-    fprintf(cycle_trace_fp, "exec1_src0 %08x\n", spro->exec1_src0); // 3 bits
-    fprintf(cycle_trace_fp, "exec1_src1 %08x\n", spro->exec1_src1); // 3 bits
-    fprintf(cycle_trace_fp, "exec1_dst %08x\n", spro->exec1_dst); // 3 bits
-    fprintf(cycle_trace_fp, "exec1_immediate %08x\n", spro->exec1_immediate); // 32 bits
-    fprintf(cycle_trace_fp, "exec1_alu0 %08x\n", spro->exec1_alu0); // 32 bits
-    fprintf(cycle_trace_fp, "exec1_alu1 %08x\n", spro->exec1_alu1); // 32 bits
-    fprintf(cycle_trace_fp, "exec1_aluout %08x\n", spro->exec1_aluout);
-
-    fprintf(cycle_trace_fp, "\n");
+    fprintf(sp->cycle_trace_fp, "cycle %d\n", spro->cycle_counter);
+    llsim_trace_registers(sp->unit, sp->cycle_trace_fp);
+    fprintf(sp->cycle_trace_fp, "\n");
 
     sp_printf("cycle_counter %08x\n", spro->cycle_counter);
     sp_printf("r2 %08x, r3 %08x\n", spro->r[2], spro->r[3]);
@@ -613,43 +734,43 @@ static void sp_ctl(sp_t *sp)
     sp_printf("fetch0_pc %d, fetch1_pc %d, dec0_pc %d, dec1_pc %d, exec0_pc %d, exec1_pc %d\n",
               spro->fetch0_pc, spro->fetch1_pc, spro->dec0_pc, spro->dec1_pc, spro->exec0_pc, spro->exec1_pc);
 
-    sprn->cycle_counter = spro->cycle_counter + 1;
+    SPRN(cycle_counter) = spro->cycle_counter + 1;
 
     if (sp->start)
-        sprn->fetch0_active = 1;
+        SPRN(fetch0_active) = 1;
 
     // our code BEGIN
 
     // fetch0
-    sprn->fetch1_active = 0;
+    SPRN(fetch1_active) = 0;
     if (spro->fetch0_active) {
         llsim_mem_read(sp->srami, spro->fetch0_pc);    // read instruction @ pc
-        sprn->fetch0_pc = (spro->fetch0_pc + 1) & 0xffff;           // advance PC (and handle overflow)
+        SPRN(fetch0_pc) = (spro->fetch0_pc + 1) & 0xffff;           // advance PC (and handle overflow)
 
         // update micro architecture registers
-        sprn->fetch1_active = 1;
-        sprn->fetch1_pc = spro->fetch0_pc;
+        SPRN(fetch1_active) = 1;
+        SPRN(fetch1_pc) = spro->fetch0_pc;
     }
     else {
-        sprn->fetch1_active = 0;    // propagate inactivity
+        SPRN(fetch1_active) = 0;    // propagate inactivity
     }
 
     // fetch1
     if (spro->fetch1_active) {
-        sprn->dec0_inst = llsim_mem_extract(sp->srami, spro->fetch1_pc, 31, 0);
+        SPRN(dec0_inst) = llsim_mem_extract(sp->srami, spro->fetch1_pc, 31, 0);
 
         // update micro architecture registers
-        sprn->dec0_active = 1;
-        sprn->dec0_pc = spro->fetch1_pc;
+        SPRN(dec0_active) = 1;
+        SPRN(dec0_pc) = spro->fetch1_pc;
     }
     else {
-        sprn->dec0_active = 0;    // propagate inactivity;
+        SPRN(dec0_active) = 0;    // propagate inactivity;
     }
 
     // dec0
     if (spro->dec0_active) {
         // branch prediction is 'taken'
-        if (IS_COND_BRANCH((spro->dec0_inst >> 25) & 0x1f) && branch_counter > 1) {
+        if (IS_COND_BRANCH((spro->dec0_inst >> 25) & 0x1f) && sp->branch_counter > 1) {
             flush(sp, DEC0, (spro->dec0_inst & 0xffff));
         }
 
@@ -663,24 +784,24 @@ static void sp_ctl(sp_t *sp)
                 // if no hazard continue as usual
             default:
                 // parse operation
-                sprn->dec1_opcode = (spro->dec0_inst >> 25) & 0x1f;
-                sprn->dec1_dst = (spro->dec0_inst >> 22) & 0x7;
-                sprn->dec1_src0 = (spro->dec0_inst >> 19) & 0x7;
-                sprn->dec1_src1 = (spro->dec0_inst >> 16) & 0x7;
-                sprn->dec1_immediate = spro->dec0_inst & 0xffff;
+                SPRN(dec1_opcode) = (spro->dec0_inst >> 25) & 0x1f;
+                SPRN(dec1_dst) = (spro->dec0_inst >> 22) & 0x7;
+                SPRN(dec1_src0) = (spro->dec0_inst >> 19) & 0x7;
+                SPRN(dec1_src1) = (spro->dec0_inst >> 16) & 0x7;
+                SPRN(dec1_immediate) = spro->dec0_inst & 0xffff;
 
                 // sign extend immediate
-                sprn->dec1_immediate += (int)((sprn->dec1_immediate & 0x8000) ? 0xffff0000 : 0x0);
+                SPRN(dec1_immediate) += (int)((sprn->dec1_immediate & 0x8000) ? 0xffff0000 : 0x0);
 
                 // update micro architecture registers
-                sprn->dec1_inst = spro->dec0_inst;
-                sprn->dec1_active = 1;
-                sprn->dec1_pc = spro->dec0_pc;
+                SPRN(dec1_inst) = spro->dec0_inst;
+                SPRN(dec1_active) = 1;
+                SPRN(dec1_pc) = spro->dec0_pc;
                 break;
         }
     }
     else {
-        sprn->dec1_active = 0;
+        SPRN(dec1_active) = 0;
     }
 
     // dec1
@@ -695,12 +816,12 @@ static void sp_ctl(sp_t *sp)
             switch (spro->dec1_src0) {
                 // r[0] is always 0
                 case 0:
-                    sprn->exec0_alu0 = 0;
+                    SPRN(exec0_alu0) = 0;
                     break;
                 // r[1] is immediate
                 case 1:
-                    sprn->r[1] = spro->dec1_immediate;
-                    sprn->exec0_alu0 = spro->dec1_immediate;
+                    SPRN(r[1]) = spro->dec1_immediate;
+                    SPRN(exec0_alu0) = spro->dec1_immediate;
                     break;
                 // src0 is r[2] to r[7]
                 default:
@@ -708,19 +829,19 @@ static void sp_ctl(sp_t *sp)
                     switch (check_hazard_dec1(sp, 0)) {
                         // no hazard, continue as usual
                         case NO_HAZARD:
-                            sprn->exec0_alu0 = spro->r[spro->dec1_src0];
+                            SPRN(exec0_alu0) = spro->r[spro->dec1_src0];
                             break;
                         // control hazard, bypass PC
                         case CTRL_HAZARD:
-                            sprn->exec0_alu0 = spro->exec1_pc;
+                            SPRN(exec0_alu0) = spro->exec1_pc;
                             break;
                         // data hazard, bypass loaded value
                         case DATA_HAZARD:
-                            sprn->exec0_alu0 = llsim_mem_extract_dataout(sp->sramd, 31, 0);
+                            SPRN(exec0_alu0) = llsim_mem_extract_dataout(sp->sramd, 31, 0);
                             break;
                         // reg value hazard, bypass result
                         case REG_HAZARD:
-                            sprn->exec0_alu0 = spro->exec1_aluout;
+                            SPRN(exec0_alu0) = spro->exec1_aluout;
                             break;
                     }
                     break;
@@ -729,12 +850,12 @@ static void sp_ctl(sp_t *sp)
             switch (spro->dec1_src1) {
                 // r[0] is always 0
                 case 0:
-                    sprn->exec0_alu1 = 0;
+                    SPRN(exec0_alu1) = 0;
                     break;
                 // r[1] is immediate
                 case 1:
-                    sprn->r[1] = spro->dec1_immediate;
-                    sprn->exec0_alu1 = spro->dec1_immediate;
+                    SPRN(r[1]) = spro->dec1_immediate;
+                    SPRN(exec0_alu1) = spro->dec1_immediate;
                     break;
                 // src1 is r[2] to r[7]
                 default:
@@ -742,19 +863,19 @@ static void sp_ctl(sp_t *sp)
                     switch (check_hazard_dec1(sp, 1)) {
                         // no hazard, continue as usual
                         case NO_HAZARD:
-                            sprn->exec0_alu1 = spro->r[spro->dec1_src1];
+                            SPRN(exec0_alu1) = spro->r[spro->dec1_src1];
                             break;
                         // control hazard, bypass PC
                         case CTRL_HAZARD:
-                            sprn->exec0_alu1 = spro->exec1_pc;
+                            SPRN(exec0_alu1) = spro->exec1_pc;
                             break;
                         // data hazard, bypass loaded value
                         case DATA_HAZARD:
-                            sprn->exec0_alu1 = llsim_mem_extract_dataout(sp->sramd, 31, 0);
+                            SPRN(exec0_alu1) = llsim_mem_extract_dataout(sp->sramd, 31, 0);
                             break;
                         // reg value hazard, bypass result
                         case REG_HAZARD:
-                            sprn->exec0_alu1 = spro->exec1_aluout;
+                            SPRN(exec0_alu1) = spro->exec1_aluout;
                             break;
                     }
                     break;
@@ -762,17 +883,17 @@ static void sp_ctl(sp_t *sp)
         }
 
         // update micro architecture registers
-        sprn->exec0_pc = spro->dec1_pc;
-        sprn->exec0_inst = spro->dec1_inst;
-        sprn->exec0_opcode = spro->dec1_opcode;
-        sprn->exec0_dst = spro->dec1_dst;
-        sprn->exec0_src0 = spro->dec1_src0;
-        sprn->exec0_src1 = spro->dec1_src1;
-        sprn->exec0_immediate = spro->dec1_immediate;
-        sprn->exec0_active = 1;
+        SPRN(exec0_pc) = spro->dec1_pc;
+        SPRN(exec0_inst) = spro->dec1_inst;
+        SPRN(exec0_opcode) = spro->dec1_opcode;
+        SPRN(exec0_dst) = spro->dec1_dst;
+        SPRN(exec0_src0) = spro->dec1_src0;
+        SPRN(exec0_src1) = spro->dec1_src1;
+        SPRN(exec0_immediate) = spro->dec1_immediate;
+        SPRN(exec0_active) = 1;
     }
     else {
-        sprn->exec0_active = 0;
+        SPRN(exec0_active) = 0;
     }
 
     // exec0
@@ -781,18 +902,18 @@ static void sp_ctl(sp_t *sp)
 
         // if stall, then preserve state
         if (spro->exec0_opcode == NOP) {
-            sprn->exec1_pc = spro->exec1_pc;
-            sprn->exec1_inst = spro->exec1_inst;
-            sprn->exec1_opcode = spro->exec1_opcode;
-            sprn->exec1_dst = spro->exec1_dst;
-            sprn->exec1_src0 = spro->exec1_src0;
-            sprn->exec1_src1 = spro->exec1_src1;
-            sprn->exec1_immediate = spro->exec1_immediate;
-
-            sprn->exec1_alu0 = spro->exec1_alu0;
-            sprn->exec1_alu1 = spro->exec1_alu1;
-
-            sprn->exec1_active = 0;
+            SPRN(exec1_pc) = spro->exec1_pc;
+            SPRN(exec1_inst) = spro->exec1_inst;
+            SPRN(exec1_opcode) = spro->exec1_opcode;
+            SPRN(exec1_dst) = spro->exec1_dst;
+            SPRN(exec1_src0) = spro->exec1_src0;
+            SPRN(exec1_src1) = spro->exec1_src1;
+            SPRN(exec1_immediate) = spro->exec1_immediate;
+
+            SPRN(exec1_alu0) = spro->exec1_alu0;
+            SPRN(exec1_alu1) = spro->exec1_alu1;
+
+            SPRN(exec1_active) = 0;
         }
             // if not in a stall resume operation
         else {
@@ -839,28 +960,28 @@ static void sp_ctl(sp_t *sp)
             // execute operation
             switch (spro->exec0_opcode) {
                 case ADD:
-                    sprn->exec1_aluout = alu0 + alu1;
+                    SPRN(exec1_aluout) = alu0 + alu1;
                     break;
                 case SUB:
-                    sprn->exec1_aluout = alu0 - alu1;
+                    SPRN(exec1_aluout) = alu0 - alu1;
                     break;
                 case LSF:
-                    sprn->exec1_aluout = alu0 << alu1;
+                    SPRN(exec1_aluout) = alu0 << alu1;
                     break;
                 case RSF:
-                    sprn->exec1_aluout = alu0 >> alu1;
+                    SPRN(exec1_aluout) = alu0 >> alu1;
                     break;
                 case AND:
-                    sprn->exec1_aluout = alu0 & alu1;
+                    SPRN(exec1_aluout) = alu0 & alu1;
                     break;
                 case OR:
-                    sprn->exec1_aluout = alu0 | alu1;
+                    SPRN(exec1_aluout) = alu0 | alu1;
                     break;
                 case XOR:
-                    sprn->exec1_aluout = alu0 ^ alu1;
+                    SPRN(exec1_aluout) = alu0 ^ alu1;
                     break;
                 case LHI:
-                    sprn->exec1_aluout = (alu0 & 0xffff) | (alu1 << 16);
+                    SPRN(exec1_aluout) = (alu0 & 0xffff) | (alu1 << 16);
                     break;
                 case LD:
                     llsim_mem_read(sp->sramd, alu1);
@@ -868,27 +989,27 @@ static void sp_ctl(sp_t *sp)
                 case ST:
                     break;
                 case CPY:
-                    sprn->dma_src = spro->exec1_alu0;
-                    sprn->dma_dst = spro->r[spro->exec1_dst];
-                    sprn->dma_len = spro->exec1_alu1;
+                    SPRN(dma_src) = spro->exec1_alu0;
+                    SPRN(dma_dst) = spro->r[spro->exec1_dst];
+                    SPRN(dma_len) = spro->exec1_alu1;
                     break;
                 case POL:
                     // POL is 1 if DMA is in use or CPY command issued
-                    sprn->exec1_aluout = ((spro->exec1_active && spro->exec1_opcode == CPY) || spro->dma_busy);
+                    SPRN(exec1_aluout) = ((spro->exec1_active && spro->exec1_opcode == CPY) || spro->dma_busy);
                 case JLT:
-                    sprn->exec1_aluout = (alu0 < alu1) ? 1 : 0;
+                    SPRN(exec1_aluout) = (alu0 < alu1) ? 1 : 0;
                     break;
                 case JLE:
-                    sprn->exec1_aluout = (alu0 <= alu1) ? 1 : 0;
+                    SPRN(exec1_aluout) = (alu0 <= alu1) ? 1 : 0;
                     break;
                 case JEQ:
-                    sprn->exec1_aluout = (alu0 == alu1) ? 1 : 0;
+                    SPRN(exec1_aluout) = (alu0 == alu1) ? 1 : 0;
                     break;
                 case JNE:
-                    sprn->exec1_aluout = (alu0 != alu1) ? 1 : 0;
+                    SPRN(exec1_aluout) = (alu0 != alu1) ? 1 : 0;
                     break;
                 case JIN:
-                    sprn->exec1_aluout = 1;
+                    SPRN(exec1_aluout) = 1;
                     break;
                 case HLT:
                     break;
@@ -896,34 +1017,35 @@ static void sp_ctl(sp_t *sp)
             }
 
             // update micro architecture registers
-            sprn->exec1_pc = spro->exec0_pc;
-            sprn->exec1_inst = spro->exec0_inst;
-            sprn->exec1_opcode = spro->exec0_opcode;
-            sprn->exec1_dst = spro->exec0_dst;
-            sprn->exec1_src0 = spro->exec0_src0;
-            sprn->exec1_src1 = spro->exec0_src1;
-            sprn->exec1_immediate = spro->exec0_immediate;
-
-            sprn->exec1_alu0 = alu0;
-            sprn->exec1_alu1 = alu1;
-
-            sprn->exec1_active = 1;
+            SPRN(exec1_pc) = spro->exec0_pc;
+            SPRN(exec1_inst) = spro->exec0_inst;
+            SPRN(exec1_opcode) = spro->exec0_opcode;
+            SPRN(exec1_dst) = spro->exec0_dst;
+            SPRN(exec1_src0) = spro->exec0_src0;
+            SPRN(exec1_src1) = spro->exec0_src1;
+            SPRN(exec1_immediate) = spro->exec0_immediate;
+
+            SPRN(exec1_alu0) = alu0;
+            SPRN(exec1_alu1) = alu1;
+
+            SPRN(exec1_active) = 1;
         }
     }
     else {
-        sprn->exec1_active = 0;
+        SPRN(exec1_active) = 0;
     }
 
     // exec1
     if (spro->exec1_active) {
         print_trace(sp);
-        inst_count++;
+        sp->inst_count++;
+        llsim_event(sp->sim, sp->unit, LLSIM_EVENT_RETIRE, .pc = spro->exec1_pc, .inst = spro->exec1_inst);
 
         if (spro->exec1_opcode == HLT) {
-            fprintf(inst_trace_fp, "sim finished at pc %d, %d instructions", spro->exec1_pc, inst_count);
-//            fclose(inst_trace_fp);
+            fprintf(sp->inst_trace_fp, "sim finished at pc %d, %d instructions", spro->exec1_pc, sp->inst_count);
+//            fclose(sp->inst_trace_fp);
 
-            llsim_stop();
+            llsim_stop(sp->sim);
             dump_sram(sp, "srami_out.txt", sp->srami);
             dump_sram(sp, "sramd_out.txt", sp->sramd);
         }
@@ -939,11 +1061,11 @@ static void sp_ctl(sp_t *sp)
                 case LHI:
                 case POL:
                     if (spro->exec1_dst > 1)
-                        sprn->r[spro->exec1_dst] = spro->exec1_aluout;
+                        SPRN(r[spro->exec1_dst]) = spro->exec1_aluout;
                     break;
                 case LD:
                     if (spro->exec1_dst > 1)
-                        sprn->r[spro->exec1_dst] =  llsim_mem_extract(sp->sramd, spro->exec1_alu1, 31, 0);
+                        SPRN(r[spro->exec1_dst]) =  llsim_mem_extract(sp->sramd, spro->exec1_alu1, 31, 0);
                     break;
                 case ST:
                     llsim_mem_set_datain(sp->sramd, spro->exec1_alu0, 31, 0);
@@ -956,9 +1078,9 @@ static void sp_ctl(sp_t *sp)
                     }
 
                     // set registers
-                    sprn->dma_dst = spro->r[spro->exec1_dst];
-                    sprn->dma_src = spro->exec1_alu0;
-                    sprn->dma_len = spro->exec1_alu1;
+                    SPRN(dma_dst) = spro->r[spro->exec1_dst];
+                    SPRN(dma_src) = spro->exec1_alu0;
+                    SPRN(dma_len) = spro->exec1_alu1;
                     break;
                 case JLT:
                 case JLE:
@@ -998,79 +1120,211 @@ static void sp_run(llsim_unit_t *unit)
 
     //	llsim_printf("-------------------------\n");
 
-    if (llsim->reset) {
+    // old and new swap on every commit
+    sp->spro = sp->regs->old;
+    sp->sprn = sp->regs->new;
+
+    if (unit->sim->reset) {
         sp_reset(sp);
         return;
     }
 
-    sp->srami->read = 0;
-    sp->srami->write = 0;
-    sp->sramd->read = 0;
-    sp->sramd->write = 0;
-
     sp_ctl(sp);
 }
 
 static void sp_generate_sram_memory_image(sp_t *sp, char *program_name)
 {
     FILE *fp;
-    int addr, i;
+    unsigned int chunk[LLSIM_MEM_PAGE_ENTRIES];
+    int addr, n;
 
     fp = fopen(program_name, "r");
     if (fp == NULL) {
         printf("couldn't open file %s\n", program_name);
         exit(1);
     }
+    // inject straight into the (sparse) srams a chunk at a time, no image copy is kept
     addr = 0;
+    n = 0;
     while (addr < SP_SRAM_HEIGHT) {
-        if (fscanf(fp, "%08x\n", &sp->memory_image[addr]));
-        //              printf("addr %x: %08x\n", addr, sp->memory_image[addr]);
+        chunk[n] = 0;
+        if (fscanf(fp, "%08x\n", &chunk[n]));
+        //              printf("addr %x: %08x\n", addr, chunk[n]);
         addr++;
+        if (++n == LLSIM_MEM_PAGE_ENTRIES || feof(fp)) {
+            llsim_mem_inject_array(sp->srami, addr - n, (int *) chunk, n);
+            llsim_mem_inject_array(sp->sramd, addr - n, (int *) chunk, n);
+            n = 0;
+        }
         if (feof(fp))
             break;
     }
+    fclose(fp);
     sp->memory_image_size = addr;
 
-    fprintf(inst_trace_fp, "program %s loaded, %d lines\n", program_name, addr);
-
-    for (i = 0; i < sp->memory_image_size; i++) {
-        llsim_mem_inject(sp->srami, i, sp->memory_image[i], 31, 0);
-        llsim_mem_inject(sp->sramd, i, sp->memory_image[i], 31, 0);
-    }
+    fprintf(sp->inst_trace_fp, "program %s loaded, %d lines\n", program_name, addr);
 }
 
-void sp_init(char *program_name)
+// trace files are (re)started at the current output prefix
+static void sp_open_traces(sp_t *sp)
 {
-    llsim_unit_t *llsim_sp_unit;
-    llsim_unit_registers_t *llsim_ur;
-    sp_t *sp;
-
-    llsim_printf("initializing sp unit\n");
+    if (sp->inst_trace_fp)
+        fclose(sp->inst_trace_fp);
+    if (sp->cycle_trace_fp)
+        fclose(sp->cycle_trace_fp);
 
-    inst_trace_fp = fopen("inst_trace.txt", "w");
-    if (inst_trace_fp == NULL) {
+    sp->inst_trace_fp = llsim_fopen(sp->sim, "inst_trace.txt", "w");
+    if (sp->inst_trace_fp == NULL) {
         printf("couldn't open file inst_trace.txt\n");
         exit(1);
     }
 
-    cycle_trace_fp = fopen("cycle_trace.txt", "w");
-    if (cycle_trace_fp == NULL) {
+    sp->cycle_trace_fp = llsim_fopen(sp->sim, "cycle_trace.txt", "w");
+    if (sp->cycle_trace_fp == NULL) {
         printf("couldn't open file cycle_trace.txt\n");
         exit(1);
     }
+}
+
+// the model comes up empty, a program is loaded into it before it runs
+static void sp_load(llsim_unit_t *unit, char *program_name)
+{
+    sp_t *sp = (sp_t *) unit->private;
 
-    llsim_sp_unit = llsim_register_unit("sp", sp_run);
+    sp->program_name = llsim_intern(sp->sim, program_name);
+    sp_open_traces(sp);
+    sp_generate_sram_memory_image(sp, program_name);
+}
+
+// the srams are back as loaded, the traces start over as the load started them
+static void sp_reset_run(llsim_unit_t *unit)
+{
+    sp_t *sp = (sp_t *) unit->private;
+
+    sp->start = 1;
+    // our code BEGIN
+    sp->branch_counter = 0;
+    sp->inst_count = 0;
+    sp->dma_start = 0;
+    sp->mem_busy = 0;
+    sp->dma_fetch_src = 0;
+    sp->dma_fetch_dst = 0;
+    sp->dma_fetch_n = 0;
+    memset(sp->dma_buf, 0, sizeof(sp->dma_buf));
+    // our code END
+
+    sp_open_traces(sp);
+    fprintf(sp->inst_trace_fp, "program %s loaded, %d lines\n", sp->program_name, sp->memory_image_size);
+}
+
+static void sp_destroy(llsim_unit_t *unit)
+{
+    sp_t *sp = (sp_t *) unit->private;
+
+    if (sp->inst_trace_fp)
+        fclose(sp->inst_trace_fp);
+    if (sp->cycle_trace_fp)
+        fclose(sp->cycle_trace_fp);
+    sp->inst_trace_fp = NULL;
+    sp->cycle_trace_fp = NULL;
+}
+
+/*
+ * checkpoints: what the unit keeps outside its registers and srams. the
+ * trace files are flushed on save so they are complete up to the
+ * checkpoint, and restarted on restore to hold what follows it.
+ */
+static void sp_save(llsim_unit_t *unit, FILE *fp)
+{
+    sp_t *sp = (sp_t *) unit->private;
+
+    fflush(sp->inst_trace_fp);
+    fflush(sp->cycle_trace_fp);
+    llsim_checkpoint_write(fp, &sp->memory_image_size, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->start, sizeof(int));
+    // our code BEGIN
+    llsim_checkpoint_write(fp, &sp->branch_counter, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->inst_count, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->dma_start, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->mem_busy, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->dma_fetch_src, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->dma_fetch_dst, sizeof(int));
+    llsim_checkpoint_write(fp, &sp->dma_fetch_n, sizeof(int));
+    llsim_checkpoint_write(fp, sp->dma_buf, sizeof(sp->dma_buf));
+    // our code END
+}
+
+static void sp_restore(llsim_unit_t *unit, FILE *fp)
+{
+    sp_t *sp = (sp_t *) unit->private;
+
+    llsim_checkpoint_read(fp, &sp->memory_image_size, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->start, sizeof(int));
+    // our code BEGIN
+    llsim_checkpoint_read(fp, &sp->branch_counter, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->inst_count, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->dma_start, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->mem_busy, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->dma_fetch_src, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->dma_fetch_dst, sizeof(int));
+    llsim_checkpoint_read(fp, &sp->dma_fetch_n, sizeof(int));
+    llsim_checkpoint_read(fp, sp->dma_buf, sizeof(sp->dma_buf));
+    // a burst in flight moves through dma_buf
+    if (sp->sramd->port[sp->dma_port].burst)
+        sp->sramd->port[sp->dma_port].burst_buf = sp->dma_buf;
+    // our code END
+
+    sp_open_traces(sp);
+}
+
+void sp_init(llsim_t *sim)
+{
+    llsim_unit_t *llsim_sp_unit;
+    llsim_unit_registers_t *llsim_ur;
+    sp_t *sp;
+    int i;
+
+    llsim_printf("initializing sp unit\n");
+
+    llsim_sp_unit = llsim_register_unit(sim, "sp", sp_run);
     llsim_ur = llsim_allocate_registers(llsim_sp_unit, "sp_registers", sizeof(sp_registers_t));
-    sp = llsim_malloc(sizeof(sp_t));
+    sp = llsim_malloc(sim, sizeof(sp_t));
+    sp->sim = sim;
+    sp->unit = llsim_sp_unit;
 
     llsim_sp_unit->private = sp;
+    llsim_sp_unit->load = sp_load;
+    llsim_sp_unit->reset_run = sp_reset_run;
+    llsim_sp_unit->destroy = sp_destroy;
+    llsim_sp_unit->save = sp_save;
+    llsim_sp_unit->restore = sp_restore;
+    llsim_track_registers(llsim_ur);
+    sp->regs = llsim_ur;
     sp->spro = llsim_ur->old;
     sp->sprn = llsim_ur->new;
+    for (i = 0; i < sizeof(sp_fields) / sizeof(sp_fields[0]); i++)
+        llsim_register_register(sim, "sp", sp_fields[i].name, sp_fields[i].bits, 0,
+                                (char *) llsim_ur->old + sp_fields[i].offset,
+                                (char *) llsim_ur->new + sp_fields[i].offset, sp_fields[i].flags);
 
     sp->srami = llsim_allocate_memory(llsim_sp_unit, "srami", 32, SP_SRAM_HEIGHT, 0);
-    sp->sramd = llsim_allocate_memory(llsim_sp_unit, "sramd", 32, SP_SRAM_HEIGHT, 0);
-    sp_generate_sram_memory_image(sp, program_name);
-
+    // -p sramd_ports=2 gives the DMA its own sramd port
+    sp->sramd = llsim_allocate_memory(llsim_sp_unit, "sramd", 32, SP_SRAM_HEIGHT, llsim_param(sim, "sramd_ports", 0));
+    if (sp->sramd->nr_ports > 1) {
+        sp->dma_port = 1;
+        llsim_mem_set_collision(sp->sramd, LLSIM_MEM_COLLISION_READ_FIRST);
+    }
+    // -p dma_burst=w copies in bursts moving w words per cycle
+    sp->dma_burst = llsim_param(sim, "dma_burst", 0);
+    if (sp->dma_burst) {
+        llsim_assert(sp->dma_port, "ERROR: dma_burst needs -p sramd_ports=2\n");
+        llsim_mem_set_bandwidth(sp->sramd, sp->dma_burst);
+    }
+    // -p dma_latency=n puts n cycles of read latency behind the DMA's port
+    if (llsim_param(sim, "dma_latency", 1) > 1) {
+        llsim_assert(sp->dma_port, "ERROR: dma_latency needs -p sramd_ports=2\n");
+        llsim_mem_set_port_latency(sp->sramd, sp->dma_port, llsim_param(sim, "dma_latency", 1), 1, llsim_param(sim, "dma_latency", 1));
+    }
     sp->start = 1;
 
     // c2v_translate_end
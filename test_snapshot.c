@@ -0,0 +1,122 @@
+/*
+ * memory snapshots against full copies of the contents, with and without
+ * llsim_snapshot_protect. the memories are narrow enough that several
+ * memory pages share a system page.
+ *
+ * make test_snapshot && ./test_snapshot
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "llsim.h"
+
+#define TEST_SNAPS	64
+
+static int failed;
+
+static void test_unit(llsim_unit_t *unit)
+{
+}
+
+static void check(int ok, char *what, int protect, int bits, int addr)
+{
+	if (!ok && failed++ < 10)
+		printf("FAIL %s: protect %d, %d bit memory, addr %d\n", what, protect, bits, addr);
+}
+
+// the case that found write faults covering more than the page they were for
+static void test_shared_system_page(int protect)
+{
+	llsim_t *sim = llsim_create();
+	llsim_memory_t *mem;
+	llsim_snapshot_t *snap;
+
+	if (protect)
+		llsim_snapshot_protect(sim);
+	mem = llsim_allocate_memory(llsim_register_unit(sim, "test", test_unit), "mem", 32, 1024, 0);
+	llsim_finalize(sim);
+	llsim_mem_inject(mem, 256, 7, 31, 0);
+	llsim_snapshot(sim);
+	llsim_mem_inject(mem, 0, 1, 31, 0);
+	llsim_mem_inject(mem, 256, 42, 31, 0);
+	snap = llsim_snapshot(sim);
+	check(llsim_snapshot_entry(snap, mem, 256)[0] == 42, "write next to a faulted page", protect, 32, 256);
+	llsim_destroy(sim);
+}
+
+/*
+ * random writes, through the write path and, when protected, through
+ * entry pointers into pages already written (others still map the shared
+ * zero page), with a snapshot every so often. every snapshot must
+ * match the copy taken with it, and restoring any of them must bring the
+ * contents back.
+ */
+static void test_random(int protect, int bits, int height)
+{
+	llsim_t *sim = llsim_create();
+	llsim_memory_t *mem;
+	llsim_snapshot_t *snap[TEST_SNAPS];
+	int *copy[TEST_SNAPS], *now, *entry;
+	char *written;
+	int words = (bits + 31) / 32, nr_snaps = 0, i, j, addr;
+
+	if (protect)
+		llsim_snapshot_protect(sim);
+	mem = llsim_allocate_memory(llsim_register_unit(sim, "test", test_unit), "mem", bits, height, 0);
+	llsim_finalize(sim);
+	now = calloc(height * words, sizeof(int));
+	written = calloc(height / LLSIM_MEM_PAGE_ENTRIES, 1);
+
+	srand(bits * height + protect);
+	while (nr_snaps < TEST_SNAPS) {
+		addr = rand() % height;
+		j = rand() % words;
+		i = rand();
+		if (protect && written[addr / LLSIM_MEM_PAGE_ENTRIES] && rand() % 4 == 0) {
+			entry = (int *) llsim_mem_entry(mem, addr);
+			entry[j] = i;
+		} else {
+			llsim_mem_inject(mem, addr, i, j * 32 + 31, j * 32);
+			written[addr / LLSIM_MEM_PAGE_ENTRIES] = 1;
+		}
+		now[addr * words + j] = i;
+		if (rand() % 50 == 0) {
+			snap[nr_snaps] = llsim_snapshot(sim);
+			copy[nr_snaps] = malloc(height * words * sizeof(int));
+			memcpy(copy[nr_snaps], now, height * words * sizeof(int));
+			nr_snaps++;
+		}
+	}
+
+	for (i = 0; i < nr_snaps; i++)
+		for (addr = 0; addr < height; addr++)
+			check(!memcmp(llsim_snapshot_entry(snap[i], mem, addr), &copy[i][addr * words], words * sizeof(int)),
+			      "snapshot differs from copy", protect, bits, addr);
+	for (i = nr_snaps - 1; i >= 0; i -= 7) {
+		llsim_snapshot_restore(snap[i]);
+		for (addr = 0; addr < height; addr++)
+			check(!memcmp(llsim_mem_entry(mem, addr), &copy[i][addr * words], words * sizeof(int)),
+			      "restore differs from copy", protect, bits, addr);
+	}
+
+	for (i = 0; i < nr_snaps; i++)
+		free(copy[i]);
+	free(now);
+	free(written);
+	llsim_destroy(sim);
+}
+
+int main(int argc, char **argv)
+{
+	int protect;
+
+	for (protect = 0; protect <= 1; protect++) {
+		test_shared_system_page(protect);
+		test_random(protect, 32, 1024);
+		test_random(protect, 32, 16 * 1024);
+		test_random(protect, 64, 4096);
+		test_random(protect, 128, 2048);
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed != 0;
+}